@@ -90,9 +90,10 @@ void annPrintPt(						// print a point
 //
 //		annAllocPts() allocates an array of points as well a place
 //		to store their coordinates, and initializes the points to
-//		point to their respective coordinates.  It allocates point
-//		storage in a contiguous block large enough to store all the
-//		points.  It performs no initialization.
+//		point to their respective coordinates.  It allocates the
+//		array of points and the coordinates in one block (the
+//		coordinates following the points), so that one allocation
+//		serves both.  It performs no initialization.
 //
 //		annDeallocPts() should only be used on point arrays allocated
 //		by annAllocPts since it assumes that points are allocated in
@@ -115,8 +116,12 @@ ANNpoint annAllocPt(int dim, ANNcoord c)		// allocate 1 point
    
 ANNpointArray annAllocPts(int n, int dim)		// allocate n pts in dim
 {
-	ANNpointArray pa = new ANNpoint[n];			// allocate points
-	ANNpoint	  p  = new ANNcoord[n*dim];		// allocate space for coords
+												// coords start after points
+	size_t pt_bytes = ((n*sizeof(ANNpoint) + sizeof(ANNcoord)-1)
+						/ sizeof(ANNcoord)) * sizeof(ANNcoord);
+	char		  *block = new char[pt_bytes + n*dim*sizeof(ANNcoord)];
+	ANNpointArray pa = (ANNpointArray) block;	// the points
+	ANNpoint	  p  = (ANNpoint) (block + pt_bytes);	// the coords
 	for (int i = 0; i < n; i++) {
 		pa[i] = &(p[i*dim]);
 	}
@@ -131,8 +136,7 @@ void annDeallocPt(ANNpoint &p)					// deallocate 1 point
    
 void annDeallocPts(ANNpointArray &pa)			// deallocate points
 {
-	delete [] pa[0];							// dealloc coordinate storage
-	delete [] pa;								// dealloc points
+	delete [] (char *) pa;						// dealloc points and coords
 	pa = NULL;
 }
    
@@ -187,7 +191,6 @@ void annError(char *msg, ANNerr level)
 //----------------------------------------------------------------------
 
 int	ANNmaxPtsVisited = 0;	// maximum number of pts visited
-int	ANNptsVisited;			// number of pts visited in search
 
 //----------------------------------------------------------------------
 //	Global function declarations
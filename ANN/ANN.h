@@ -403,9 +403,8 @@ typedef ANNidx*   ANNidxArray;		// an array of point indices
 //				Allocate and deallocate an array of points as well a
 //				place to store their coordinates, and initializes the
 //				points to point to their respective coordinates.  It
-//				allocates point storage in a contiguous block large
-//				enough to store all the points.  It performs no
-//				initialization.
+//				allocates the point array and the coordinates in one
+//				contiguous block.  It performs no initialization.
 //
 //		annCopyPt():
 //				Creates a copy of a given point, allocating space for
@@ -608,6 +607,27 @@ enum ANNshrinkRule {
 		ANN_BD_SUGGEST			= 3};	// the authors' suggested choice
 const int ANN_N_SHRINK_RULES	= 4;	// number of shrink rules
 
+//----------------------------------------------------------------------
+// kd-tree layouts
+//		The nodes of a kd-tree may be stored in one of two ways.  In
+//		the standard layout (ANN_LAYOUT_NODES) every node is a
+//		separately allocated object, and the search visits them
+//		through virtual function calls.  In the flat layout
+//		(ANN_LAYOUT_FLAT) the nodes are entries of a single array in
+//		depth-first order, refer to their children by index, and are
+//		searched by a simple loop.  The flat tree also keeps its own
+//		copy of the point coordinates, grouped by leaf, so that a
+//		leaf is searched several points at a time with SIMD
+//		instructions.  It is faster to search, especially for large
+//		trees in low dimension, and works best with larger buckets
+//		(8 to 32 points).  It is only available for kd-trees (not
+//		bd-trees).
+//----------------------------------------------------------------------
+
+enum ANNlayout {
+		ANN_LAYOUT_NODES		= 0,	// separately allocated nodes
+		ANN_LAYOUT_FLAT			= 1};	// contiguous array of nodes
+
 //----------------------------------------------------------------------
 //	kd-tree:
 //		The main search data structure supported by ANN is a kd-tree.
@@ -617,8 +637,9 @@ const int ANN_N_SHRINK_RULES	= 4;	// number of shrink rules
 //		Construction:
 //		-------------
 //		The constructor is given the point array, number of points,
-//		dimension, bucket size (default = 1), and the splitting rule
-//		(default = ANN_KD_SUGGEST).  The point array is not copied, and
+//		dimension, bucket size (default = 1), the splitting rule
+//		(default = ANN_KD_SUGGEST), and the layout of the nodes
+//		(default = ANN_LAYOUT_NODES).  The point array is not copied, and
 //		is assumed to be kept constant throughout the lifetime of the
 //		search structure.  There is also a "load" constructor that
 //		builds a tree from a file description that was created by the
@@ -630,7 +651,11 @@ const int ANN_N_SHRINK_RULES	= 4;	// number of shrink rules
 //
 //			Standard search (annkSearch()):
 //				Searches nodes in tree-traversal order, always visiting
-//				the closer child first.
+//				the closer child first.  annkSearchBatch() does the
+//				same for an array of query points, in parallel if ANN
+//				is compiled with OpenMP.  Both it and ann1Search() can
+//				count what the searches did in an ANNsearchStats (see
+//				ANNperf.h).
 //			Priority search (annkPriSearch()):
 //				Searches nodes in order of increasing distance of the
 //				associated cell from the query point.  For many
@@ -646,6 +671,19 @@ const int ANN_N_SHRINK_RULES	= 4;	// number of shrink rules
 //		format that is suitable reading by another program.  There is a
 //		"load" constructor, which constructs a tree which is assumed to
 //		have been saved by the Dump() procedure.
+//
+//		Binary images:
+//		--------------
+//		A tree in the flat layout can also be saved by Save() as a
+//		binary image, which holds its arrays just as they are in
+//		memory (see src/kd_image.cpp).  The constructor given the name
+//		of an image file maps the file into memory, and the tree
+//		searches it in place, so that loading does not depend on the
+//		size of the tree.  The loaded tree is in the flat layout and
+//		read-only, and it owns its points (thePoints()), which are in
+//		the image too.  An image is only loaded on a machine with the
+//		same byte order and types (ANNcoord, ANNidx) as the one which
+//		saved it.
 //		
 //		Performance and Structure Statistics:
 //		-------------------------------------
@@ -666,8 +704,12 @@ const int ANN_N_SHRINK_RULES	= 4;	// number of shrink rules
 //		The second is the tree itself (which is dynamically allocated in
 //		the constructor) and is given as a pointer to its root node
 //		(root).  These nodes are automatically deallocated when the tree
-//		is deleted.  See the file src/kd_tree.h for further information
-//		on the structure of the tree nodes.
+//		is deleted.  A tree built from points takes its nodes from an
+//		arena (arena), which releases all of them at once; a tree
+//		loaded from a dump file allocates them one by one.  See the
+//		file src/kd_tree.h for further information on the structure of
+//		the tree nodes.  In the flat layout root is NULL, and the tree
+//		is instead a single array of nodes (flat), see src/kd_flat.h.
 //
 //		Each leaf of the tree does not contain a pointer directly to a
 //		point, but rather contains a pointer to a "bucket", which is an
@@ -698,8 +740,12 @@ const int ANN_N_SHRINK_RULES	= 4;	// number of shrink rules
 // See src/kd_tree.h and src/kd_tree.cpp for definitions
 //----------------------------------------------------------------------
 class ANNkdStats;				// stats on kd-tree
+class ANNsearchStats;			// stats on searches
 class ANNkd_node;				// generic node in a kd-tree
 typedef ANNkd_node*	ANNkd_ptr;	// pointer to a kd-tree node
+class ANNkd_flat;				// kd-tree in the flat layout
+class ANNarena;					// storage for the nodes of a tree
+class ANNimage;					// mapped binary image of a tree
 class ANNmin_k;
 
 class DLL_API ANNkd_tree: public ANNpointSet {
@@ -710,6 +756,11 @@ protected:
 	ANNpointArray	pts;				// the points
 	ANNidxArray		pidx;				// point indices (to pts array)
 	ANNkd_ptr		root;				// root of kd-tree
+	ANNkd_flat		*flat;				// flat tree (NULL unless flat layout)
+	ANNarena		*arena;				// node storage (NULL if on the heap)
+	ANNimage		*image;				// mapped image (NULL if not loaded
+										// ...from one)
+	int				max_pts_visit;		// limit on pts visited (0 = global)
 	ANNpoint		bnd_box_lo;			// bounding box low point
 	ANNpoint		bnd_box_hi;			// bounding box high point
 
@@ -731,11 +782,15 @@ public:
 		int				n,				// number of points
 		int				dd,				// dimension
 		int				bs = 1,			// bucket size
-		ANNsplitRule	split = ANN_KD_SUGGEST);	// splitting method
+		ANNsplitRule	split = ANN_KD_SUGGEST,	// splitting method
+		ANNlayout		layout = ANN_LAYOUT_NODES);	// layout of nodes
 
 	ANNkd_tree(							// build from dump file
 		std::istream&	in);			// input stream for dump file
 
+	ANNkd_tree(							// load (map) binary image
+		const char*		file);			// name of image file
+
 	~ANNkd_tree();						// tree destructor
 
 	void annkSearch(					// approx k near neighbor search
@@ -745,13 +800,23 @@ public:
 		ANNdistArray	dd,				// dist to near neighbors (modified)
 		double			eps=0.0);		// error bound
 
-	void ann1Search(					// approx k near neighbor search
+	void ann1Search(					// re-entrant 1 near neighbor search
 		ANNpoint	*	q,				// query point
 		ANNidxArray		nn_idx,			// nearest neighbor array (modified)
 		ANNdistArray	dd,				// dist to near neighbors (modified)
-		double			eps,		// error bound
-		ANNmin_k		*	min,
-		int				&	ptsVisited);		
+		double			eps,			// error bound
+		ANNmin_k		*	min,		// closest point set (empty or seeded)
+		int				&	ptsVisited,	// points visited (modified)
+		ANNsearchStats	*	stats = NULL);	// search stats (added to)
+
+	void annkSearchBatch(				// k near neighbors of many points
+		ANNpointArray	q,				// the query points
+		int				m,				// number of query points
+		int				k,				// number of near neighbors per query
+		ANNidxArray		nn_idx,			// nearest neighbors (m*k, modified)
+		ANNdistArray	dd,				// dist to near neighbors (m*k, modified)
+		double			eps=0.0,		// error bound
+		ANNsearchStats	*stats = NULL);	// search stats (added to)
 
 	void annkPriSearch( 				// priority k near neighbor search
 		ANNpoint		q,				// query point
@@ -777,6 +842,10 @@ public:
 	ANNpointArray thePoints()			// return pointer to points
 		{  return pts;  }
 
+	void setMaxPtsVisit(				// limit pts visited by this tree's
+		int				maxPts)			// searches (0 = use global limit)
+		{  max_pts_visit = maxPts;  }
+
 	virtual void Print(					// print the tree (for debugging)
 		ANNbool			with_pts,		// print points as well?
 		std::ostream&	out);			// output stream
@@ -784,6 +853,9 @@ public:
 	virtual void Dump(					// dump entire tree
 		ANNbool			with_pts,		// print points as well?
 		std::ostream&	out);			// output stream
+
+	void Save(							// save binary image (flat layout)
+		std::ostream&	out);			// output stream (binary mode)
 								
 	virtual void getStats(				// compute tree statistics
 		ANNkdStats&		st);			// the statistics (modified)
@@ -825,7 +897,9 @@ public:
 //----------------------------------------------------------------------
 //	Other functions
 //	annMaxPtsVisit		Sets a limit on the maximum number of points
-//						to visit in the search.
+//						to visit in the search.  It applies to all
+//						trees without a limit of their own (see
+//						ANNkd_tree::setMaxPtsVisit()).
 //  annClose			Can be called when all use of ANN is finished.
 //						It clears up a minor memory leak.
 //----------------------------------------------------------------------
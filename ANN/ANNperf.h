@@ -69,6 +69,44 @@ public:
 	void merge(const ANNkdStats &st);	// merge stats from child 
 };
 
+//----------------------------------------------------------------------
+// search stats object
+//	This object is used for collecting information about searches.
+//	Unlike the counters below, which are global and only compiled in
+//	with PERF, these are always counted, in the state of each search,
+//	and are added to a stats object given to the search (see
+//	ann1Search() and annkSearchBatch()).  A stats object is not
+//	locked, so threads which search at the same time should each
+//	have their own, and merge them afterwards.
+//----------------------------------------------------------------------
+
+class ANNsearchStats {	// stats on searches
+public:
+	int			n_queries;		// no. of searches
+	long long	n_spl;			// splitting (and shrinking) nodes visited
+	long long	n_lf;			// leaves visited
+	long long	n_pts;			// points visited
+	long long	n_lf_hit;		// leaves which added a point to the result
+	int			n_early;		// searches which reached maxPtsVisited
+ //
+							// reset stats
+	void reset()
+	{
+		n_queries = n_early = 0;
+		n_spl = n_lf = n_pts = n_lf_hit = 0;
+	}
+
+	ANNsearchStats()		// basic constructor
+	{ reset(); }
+
+	void merge(const ANNsearchStats &st)	// add stats of other searches
+	{
+		n_queries += st.n_queries;	n_early += st.n_early;
+		n_spl += st.n_spl;			n_lf += st.n_lf;
+		n_pts += st.n_pts;			n_lf_hit += st.n_lf_hit;
+	}
+};
+
 //----------------------------------------------------------------------
 //  ANNsampStat
 //	A sample stat collects numeric (double) samples and returns some
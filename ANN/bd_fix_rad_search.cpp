@@ -36,26 +36,27 @@
 //	bd_shrink::ann_FR_search - search a shrinking node
 //----------------------------------------------------------------------
 
-void ANNbd_shrink::ann_FR_search(ANNdist box_dist)
+void ANNbd_shrink::ann_FR_search(ANNdist box_dist, ANNsearchCtx &ctx)
 {
 												// check dist calc term cond.
-	if (ANNmaxPtsVisited != 0 && ANNptsVisited > ANNmaxPtsVisited) return;
+	if (ctx.maxPtsVisited != 0 && ctx.ptsVisited > ctx.maxPtsVisited) return;
 
 	ANNdist inner_dist = 0;						// distance to inner box
 	for (int i = 0; i < n_bnds; i++) {			// is query point in the box?
-		if (bnds[i].out(ANNkdFRQ)) {			// outside this bounding side?
+		if (bnds[i].out(ctx.q)) {			// outside this bounding side?
 												// add to inner distance
-			inner_dist = (ANNdist) ANN_SUM(inner_dist, bnds[i].dist(ANNkdFRQ));
+			inner_dist = (ANNdist) ANN_SUM(inner_dist, bnds[i].dist(ctx.q));
 		}
 	}
 	if (inner_dist <= box_dist) {				// if inner box is closer
-		child[ANN_IN]->ann_FR_search(inner_dist);// search inner child first
-		child[ANN_OUT]->ann_FR_search(box_dist);// ...then outer child
+		child[ANN_IN]->ann_FR_search(inner_dist, ctx);// search inner child first
+		child[ANN_OUT]->ann_FR_search(box_dist, ctx);// ...then outer child
 	}
 	else {										// if outer box is closer
-		child[ANN_OUT]->ann_FR_search(box_dist);// search outer child first
-		child[ANN_IN]->ann_FR_search(inner_dist);// ...then outer child
+		child[ANN_OUT]->ann_FR_search(box_dist, ctx);// search outer child first
+		child[ANN_IN]->ann_FR_search(inner_dist, ctx);// ...then outer child
 	}
 	ANN_FLOP(3*n_bnds)							// increment floating ops
 	ANN_SHR(1)									// one more shrinking node
+	ctx.splVisited++;							// ...counted in the search state
 }
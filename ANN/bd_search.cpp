@@ -36,50 +36,27 @@
 //	bd_shrink::ann_search - search a shrinking node
 //----------------------------------------------------------------------
 
-void ANNbd_shrink::ann_search(ANNdist box_dist)
+void ANNbd_shrink::ann_search(ANNdist box_dist, ANNsearchCtx &ctx)
 {
 												// check dist calc term cond.
-	if (ANNmaxPtsVisited != 0 && ANNptsVisited > ANNmaxPtsVisited) return;
+	if (ctx.maxPtsVisited != 0 && ctx.ptsVisited > ctx.maxPtsVisited) return;
 
 	ANNdist inner_dist = 0;						// distance to inner box
 	for (int i = 0; i < n_bnds; i++) {			// is query point in the box?
-		if (bnds[i].out(ANNkdQ)) {				// outside this bounding side?
+		if (bnds[i].out(ctx.q)) {				// outside this bounding side?
 												// add to inner distance
-			inner_dist = (ANNdist) ANN_SUM(inner_dist, bnds[i].dist(ANNkdQ));
+			inner_dist = (ANNdist) ANN_SUM(inner_dist, bnds[i].dist(ctx.q));
 		}
 	}
 	if (inner_dist <= box_dist) {				// if inner box is closer
-		child[ANN_IN]->ann_search(inner_dist);	// search inner child first
-		child[ANN_OUT]->ann_search(box_dist);	// ...then outer child
+		child[ANN_IN]->ann_search(inner_dist, ctx);	// search inner child first
+		child[ANN_OUT]->ann_search(box_dist, ctx);	// ...then outer child
 	}
 	else {										// if outer box is closer
-		child[ANN_OUT]->ann_search(box_dist);	// search outer child first
-		child[ANN_IN]->ann_search(inner_dist);	// ...then outer child
-	}
-	ANN_FLOP(3*n_bnds)							// increment floating ops
-	ANN_SHR(1)									// one more shrinking node
-}
-
-void ANNbd_shrink::ann_search1(ANNdist box_dist,ANNmin_k	*	mink,int				&	ptsVisited,ANNpoint * kqd)
-{
-												// check dist calc term cond.
-	if (ANNmaxPtsVisited != 0 && ptsVisited > ANNmaxPtsVisited) return;
-
-	ANNdist inner_dist = 0;						// distance to inner box
-	for (int i = 0; i < n_bnds; i++) {			// is query point in the box?
-		if (bnds[i].out(*kqd)) {				// outside this bounding side?
-												// add to inner distance
-			inner_dist = (ANNdist) ANN_SUM(inner_dist, bnds[i].dist(*kqd));
-		}
-	}
-	if (inner_dist <= box_dist) {				// if inner box is closer
-		child[ANN_IN]->ann_search1(inner_dist,mink,ptsVisited,kqd);	// search inner child first
-		child[ANN_OUT]->ann_search1(box_dist,mink,ptsVisited,kqd);	// ...then outer child
-	}
-	else {										// if outer box is closer
-		child[ANN_OUT]->ann_search1(box_dist,mink,ptsVisited,kqd);	// search outer child first
-		child[ANN_IN]->ann_search1(inner_dist,mink,ptsVisited,kqd);	// ...then outer child
+		child[ANN_OUT]->ann_search(box_dist, ctx);	// search outer child first
+		child[ANN_IN]->ann_search(inner_dist, ctx);	// ...then outer child
 	}
 	ANN_FLOP(3*n_bnds)							// increment floating ops
 	ANN_SHR(1)									// one more shrinking node
+	ctx.splVisited++;							// ...counted in the search state
 }
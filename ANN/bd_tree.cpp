@@ -29,6 +29,7 @@
 #include "bd_tree.h"					// bd-tree declarations
 #include "kd_util.h"					// kd-tree utilities
 #include "kd_split.h"					// kd-tree splitting rules
+#include <new>							// placement new
 
 #include <ANN/ANNperf.h>				// performance evaluation
 
@@ -111,7 +112,8 @@ ANNkd_ptr rbd_tree(						// recursive construction of bd-tree
 	int					bsp,			// bucket space
 	ANNorthRect			&bnd_box,		// bounding box for current node
 	ANNkd_splitter		splitter,		// splitting routine
-	ANNshrinkRule		shrink);		// shrinking rule
+	ANNshrinkRule		shrink,			// shrinking rule
+	ANNarena			*arena);		// storage for the nodes
 
 ANNbd_tree::ANNbd_tree(					// construct from point array
 	ANNpointArray		pa,				// point array (with at least n pts)
@@ -131,24 +133,26 @@ ANNbd_tree::ANNbd_tree(					// construct from point array
 										// copy to tree structure
 	bnd_box_lo = annCopyPt(dd, bnd_box.lo);
 	bnd_box_hi = annCopyPt(dd, bnd_box.hi);
+										// storage for about 2n/bs nodes
+	arena = new ANNarena((2*(n/(bs > 0 ? bs : 1)) + 1) * sizeof(ANNkd_split));
 
 	switch (split) {					// build by rule
 	case ANN_KD_STD:					// standard kd-splitting rule
-		root = rbd_tree(pa, pidx, n, dd, bs, bnd_box, kd_split, shrink);
+		root = rbd_tree(pa, pidx, n, dd, bs, bnd_box, kd_split, shrink, arena);
 		break;
 	case ANN_KD_MIDPT:					// midpoint split
-		root = rbd_tree(pa, pidx, n, dd, bs, bnd_box, midpt_split, shrink);
+		root = rbd_tree(pa, pidx, n, dd, bs, bnd_box, midpt_split, shrink, arena);
 		break;
 	case ANN_KD_SUGGEST:				// best (in our opinion)
 	case ANN_KD_SL_MIDPT:				// sliding midpoint split
-		root = rbd_tree(pa, pidx, n, dd, bs, bnd_box, sl_midpt_split, shrink);
+		root = rbd_tree(pa, pidx, n, dd, bs, bnd_box, sl_midpt_split, shrink, arena);
 		break;
 	case ANN_KD_FAIR:					// fair split
-		root = rbd_tree(pa, pidx, n, dd, bs, bnd_box, fair_split, shrink);
+		root = rbd_tree(pa, pidx, n, dd, bs, bnd_box, fair_split, shrink, arena);
 		break;
 	case ANN_KD_SL_FAIR:				// sliding fair split
 		root = rbd_tree(pa, pidx, n, dd, bs,
-						bnd_box, sl_fair_split, shrink);
+						bnd_box, sl_fair_split, shrink, arena);
 		break;
 	default:
 		annError("Illegal splitting method", ANNabort);
@@ -340,7 +344,8 @@ ANNkd_ptr rbd_tree(				// recursive construction of bd-tree
 	int					bsp,			// bucket space
 	ANNorthRect			&bnd_box,		// bounding box for current node
 	ANNkd_splitter		splitter,		// splitting routine
-	ANNshrinkRule		shrink)			// shrinking rule
+	ANNshrinkRule		shrink,			// shrinking rule
+	ANNarena			*arena)			// storage for the nodes
 {
 	ANNdecomp decomp;					// decomposition method
 
@@ -350,7 +355,7 @@ ANNkd_ptr rbd_tree(				// recursive construction of bd-tree
 		if (n == 0)						// empty leaf node
 			return KD_TRIVIAL;			// return (canonical) empty leaf
 		else							// construct the node and return
-			return new ANNkd_leaf(n, pidx); 
+			return new (arena->alloc(sizeof(ANNkd_leaf))) ANNkd_leaf(n, pidx);
 	}
 	
 	decomp = selectDecomp(				// select decomposition method
@@ -373,16 +378,17 @@ ANNkd_ptr rbd_tree(				// recursive construction of bd-tree
 		bnd_box.hi[cd] = cv;			// modify bounds for left subtree
 		ANNkd_ptr lo = rbd_tree(		// build left subtree
 				pa, pidx, n_lo,			// ...from pidx[0..n_lo-1]
-				dim, bsp, bnd_box, splitter, shrink);
+				dim, bsp, bnd_box, splitter, shrink, arena);
 		bnd_box.hi[cd] = hv;			// restore bounds
 
 		bnd_box.lo[cd] = cv;			// modify bounds for right subtree
 		ANNkd_ptr hi = rbd_tree(		// build right subtree
 				pa, pidx + n_lo, n-n_lo,// ...from pidx[n_lo..n-1]
-				dim, bsp, bnd_box, splitter, shrink);
+				dim, bsp, bnd_box, splitter, shrink, arena);
 		bnd_box.lo[cd] = lv;			// restore bounds
 										// create the splitting node
-		return new ANNkd_split(cd, cv, lv, hv, lo, hi);
+		return new (arena->alloc(sizeof(ANNkd_split)))
+					ANNkd_split(cd, cv, lv, hv, lo, hi);
 	}
 	else {								// shrink selected
 		int n_in;						// number of points in box
@@ -397,21 +403,23 @@ ANNkd_ptr rbd_tree(				// recursive construction of bd-tree
 				n_in);					// number of points inside (returned)
 
 		ANNkd_ptr in = rbd_tree(		// build inner subtree pidx[0..n_in-1]
-				pa, pidx, n_in, dim, bsp, inner_box, splitter, shrink);
+				pa, pidx, n_in, dim, bsp, inner_box, splitter, shrink, arena);
 		ANNkd_ptr out = rbd_tree(		// build outer subtree pidx[n_in..n]
-				pa, pidx+n_in, n - n_in, dim, bsp, bnd_box, splitter, shrink);
+				pa, pidx+n_in, n - n_in, dim, bsp, bnd_box, splitter, shrink, arena);
 
-		ANNorthHSArray bnds = NULL;		// bounds (alloc in Box2Bnds and
-										// ...freed in bd_shrink destroyer)
+		ANNorthHSArray bnds = NULL;		// bounds (alloc in Box2Bnds from
+										// ...the arena)
 
 		annBox2Bnds(					// convert inner box to bounds
 				inner_box,				// inner box
 				bnd_box,				// enclosing box
 				dim,					// dimension
 				n_bnds,					// number of bounds (returned)
-				bnds);					// bounds array (modified)
+				bnds,					// bounds array (modified)
+				arena);					// ...allocated from the arena
 
 										// return shrinking node
-		return new ANNbd_shrink(n_bnds, bnds, in, out);
+		return new (arena->alloc(sizeof(ANNbd_shrink)))
+					ANNbd_shrink(n_bnds, bnds, in, out);
 	}
 } 
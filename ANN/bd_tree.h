@@ -51,6 +51,8 @@
 //		rather poor practice, but happens to be convenient.  The list
 //		is allocated in the bd-tree building procedure rbd_tree() just
 //		prior to construction, and is used for no other purposes.
+//		There it comes from the arena of the tree, like the node, and
+//		the destructor is never called.
 //
 //		WARNING: In the near neighbor searching code it is assumed that
 //		the list of bounding halfspaces is irredundant, meaning that there
@@ -92,10 +94,9 @@ public:
 	virtual void print(int level, ostream &out);// print node
 	virtual void dump(ostream &out);			// dump node
 
-	virtual void ann_search(ANNdist);			// standard search
-	virtual void ann_search1(ANNdist,ANNmin_k	*	mink,int				&	ptsVisited,ANNpoint * kqd);			// standard search
-	virtual void ann_pri_search(ANNdist);		// priority search
-	virtual void ann_FR_search(ANNdist); 		// fixed-radius search
+	virtual void ann_search(ANNdist, ANNsearchCtx&);	// standard search
+	virtual void ann_pri_search(ANNdist, ANNsearchCtx&);// priority search
+	virtual void ann_FR_search(ANNdist, ANNsearchCtx&);	// fixed-radius search
 };
 
 #endif
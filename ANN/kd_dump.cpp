@@ -35,6 +35,7 @@
 #include <cstring>
 
 #include "kd_tree.h"					// kd-tree declarations
+#include "kd_flat.h"					// flat kd-tree declarations
 #include "bd_tree.h"					// bd-tree declarations
 
 using namespace std;					// make std:: available
@@ -126,7 +127,9 @@ void ANNkd_tree::Dump(					// dump entire tree
 	annPrintPt(bnd_box_hi, dim, out);	// print upper bound
 	out << "\n";
 
-	if (root == NULL)					// empty tree?
+	if (flat != NULL)					// flat layout?
+		flat->dump(out);
+	else if (root == NULL)				// empty tree?
 		out << "null\n";
 	else {
 		root->dump(out);				// invoke printing at root
@@ -37,20 +37,12 @@
 //----------------------------------------------------------------------
 
 //----------------------------------------------------------------------
-//		To keep argument lists short, a number of global variables
-//		are maintained which are common to all the recursive calls.
-//		These are given below.
+//		The state which is common to all the recursive calls is kept
+//		in an ANNsearchCtx (see kd_tree.h).  Besides the members used
+//		by the standard search, fixed-radius search uses sqRad and
+//		ptsInRange.
 //----------------------------------------------------------------------
 
-int				ANNkdFRDim;				// dimension of space
-ANNpoint		ANNkdFRQ;				// query point
-ANNdist			ANNkdFRSqRad;			// squared radius search bound
-double			ANNkdFRMaxErr;			// max tolerable squared error
-ANNpointArray	ANNkdFRPts;				// the points
-ANNmin_k*		ANNkdFRPointMK;			// set of k closest points
-int				ANNkdFRPtsVisited;		// total points visited
-int				ANNkdFRPtsInRange;		// number of points in the range
-
 //----------------------------------------------------------------------
 //	annkFRSearch - fixed radius search for k nearest neighbors
 //----------------------------------------------------------------------
@@ -63,29 +55,28 @@ int ANNkd_tree::annkFRSearch(
 	ANNdistArray		dd,				// the approximate nearest neighbor
 	double				eps)			// the error bound
 {
-	ANNkdFRDim = dim;					// copy arguments to static equivs
-	ANNkdFRQ = q;
-	ANNkdFRSqRad = sqRad;
-	ANNkdFRPts = pts;
-	ANNkdFRPtsVisited = 0;				// initialize count of points visited
-	ANNkdFRPtsInRange = 0;				// ...and points in the range
-
-	ANNkdFRMaxErr = ANN_POW(1.0 + eps);
+	ANNmin_k pointMK(k);				// create set for closest k points
+	ANNsearchCtx ctx(dim, q, pts, eps, &pointMK);
+	if (max_pts_visit != 0)				// tree has its own limit?
+		ctx.maxPtsVisited = max_pts_visit;
+	ctx.sqRad = sqRad;					// squared radius search bound
 	ANN_FLOP(2)							// increment floating op count
 
-	ANNkdFRPointMK = new ANNmin_k(k);	// create set for closest k points
 										// search starting at the root
-	root->ann_FR_search(annBoxDistance(q, bnd_box_lo, bnd_box_hi, dim));
+	ANNdist box_dist = annBoxDistance(q, bnd_box_lo, bnd_box_hi, dim);
+	if (flat != NULL)
+		flat->ann_FR_search(box_dist, ctx);
+	else
+		root->ann_FR_search(box_dist, ctx);
 
 	for (int i = 0; i < k; i++) {		// extract the k-th closest points
 		if (dd != NULL)
-			dd[i] = ANNkdFRPointMK->ith_smallest_key(i);
+			dd[i] = pointMK.ith_smallest_key(i);
 		if (nn_idx != NULL)
-			nn_idx[i] = ANNkdFRPointMK->ith_smallest_info(i);
+			nn_idx[i] = pointMK.ith_smallest_info(i);
 	}
 
-	delete ANNkdFRPointMK;				// deallocate closest point set
-	return ANNkdFRPtsInRange;			// return final point count
+	return ctx.ptsInRange;				// return final point count
 }
 
 //----------------------------------------------------------------------
@@ -97,18 +88,18 @@ int ANNkd_tree::annkFRSearch(
 //		code structure for the sake of uniformity.
 //----------------------------------------------------------------------
 
-void ANNkd_split::ann_FR_search(ANNdist box_dist)
+void ANNkd_split::ann_FR_search(ANNdist box_dist, ANNsearchCtx &ctx)
 {
 										// check dist calc term condition
-	if (ANNmaxPtsVisited != 0 && ANNkdFRPtsVisited > ANNmaxPtsVisited) return;
+	if (ctx.maxPtsVisited != 0 && ctx.ptsVisited > ctx.maxPtsVisited) return;
 
 										// distance to cutting plane
-	ANNcoord cut_diff = ANNkdFRQ[cut_dim] - cut_val;
+	ANNcoord cut_diff = ctx.q[cut_dim] - cut_val;
 
 	if (cut_diff < 0) {					// left of cutting plane
-		child[ANN_LO]->ann_FR_search(box_dist);// visit closer child first
+		child[ANN_LO]->ann_FR_search(box_dist, ctx);// visit closer child first
 
-		ANNcoord box_diff = cd_bnds[ANN_LO] - ANNkdFRQ[cut_dim];
+		ANNcoord box_diff = cd_bnds[ANN_LO] - ctx.q[cut_dim];
 		if (box_diff < 0)				// within bounds - ignore
 			box_diff = 0;
 										// distance to further box
@@ -116,14 +107,14 @@ void ANNkd_split::ann_FR_search(ANNdist box_dist)
 				ANN_DIFF(ANN_POW(box_diff), ANN_POW(cut_diff)));
 
 										// visit further child if in range
-		if (box_dist * ANNkdFRMaxErr <= ANNkdFRSqRad)
-			child[ANN_HI]->ann_FR_search(box_dist);
+		if (box_dist * ctx.maxErr <= ctx.sqRad)
+			child[ANN_HI]->ann_FR_search(box_dist, ctx);
 
 	}
 	else {								// right of cutting plane
-		child[ANN_HI]->ann_FR_search(box_dist);// visit closer child first
+		child[ANN_HI]->ann_FR_search(box_dist, ctx);// visit closer child first
 
-		ANNcoord box_diff = ANNkdFRQ[cut_dim] - cd_bnds[ANN_HI];
+		ANNcoord box_diff = ctx.q[cut_dim] - cd_bnds[ANN_HI];
 		if (box_diff < 0)				// within bounds - ignore
 			box_diff = 0;
 										// distance to further box
@@ -131,12 +122,13 @@ void ANNkd_split::ann_FR_search(ANNdist box_dist)
 				ANN_DIFF(ANN_POW(box_diff), ANN_POW(cut_diff)));
 
 										// visit further child if close enough
-		if (box_dist * ANNkdFRMaxErr <= ANNkdFRSqRad)
-			child[ANN_LO]->ann_FR_search(box_dist);
+		if (box_dist * ctx.maxErr <= ctx.sqRad)
+			child[ANN_LO]->ann_FR_search(box_dist, ctx);
 
 	}
 	ANN_FLOP(13)						// increment floating ops
 	ANN_SPL(1)							// one more splitting node visited
+	ctx.splVisited++;					// ...counted in the search state
 }
 
 //----------------------------------------------------------------------
@@ -145,39 +137,43 @@ void ANNkd_split::ann_FR_search(ANNdist box_dist)
 //		some fine tuning to replace indexing by pointer operations.
 //----------------------------------------------------------------------
 
-void ANNkd_leaf::ann_FR_search(ANNdist box_dist)
+void ANNkd_leaf::ann_FR_search(ANNdist box_dist, ANNsearchCtx &ctx)
 {
 	register ANNdist dist;				// distance to data point
 	register ANNcoord* pp;				// data coordinate pointer
 	register ANNcoord* qq;				// query coordinate pointer
 	register ANNcoord t;
 	register int d;
+	int hit = 0;						// did we add a point?
 
 	for (int i = 0; i < n_pts; i++) {	// check points in bucket
 
-		pp = ANNkdFRPts[bkt[i]];		// first coord of next data point
-		qq = ANNkdFRQ;					// first coord of query point
+		pp = ctx.pts[bkt[i]];			// first coord of next data point
+		qq = ctx.q;					// first coord of query point
 		dist = 0;
 
-		for(d = 0; d < ANNkdFRDim; d++) {
+		for(d = 0; d < ctx.dim; d++) {
 			ANN_COORD(1)				// one more coordinate hit
 			ANN_FLOP(5)					// increment floating ops
 
 			t = *(qq++) - *(pp++);		// compute length and adv coordinate
 										// exceeds dist to k-th smallest?
-			if( (dist = ANN_SUM(dist, ANN_POW(t))) > ANNkdFRSqRad) {
+			if( (dist = ANN_SUM(dist, ANN_POW(t))) > ctx.sqRad) {
 				break;
 			}
 		}
 
-		if (d >= ANNkdFRDim &&					// among the k best?
+		if (d >= ctx.dim &&					// among the k best?
 		   (ANN_ALLOW_SELF_MATCH || dist!=0)) { // and no self-match problem
 												// add it to the list
-			ANNkdFRPointMK->insert(dist, bkt[i]);
-			ANNkdFRPtsInRange++;				// increment point count
+			ctx.pointMK->insert(dist, bkt[i]);
+			ctx.ptsInRange++;					// increment point count
+			hit = 1;
 		}
 	}
 	ANN_LEAF(1)							// one more leaf node visited
 	ANN_PTS(n_pts)						// increment points visited
-	ANNkdFRPtsVisited += n_pts;			// increment number of points visited
+	ctx.ptsVisited += n_pts;			// increment number of points visited
+	ctx.lfVisited++;					// ...counted in the search state
+	ctx.lfHits += hit;					// and whether it added a point
 }
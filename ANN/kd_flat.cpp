@@ -0,0 +1,690 @@
+//----------------------------------------------------------------------
+// File:			kd_flat.cpp
+// Description:		Construction and search for the flat kd-tree layout
+//----------------------------------------------------------------------
+// Copyright (c) 1997-2005 University of Maryland and Sunil Arya and
+// David Mount.  All Rights Reserved.
+//
+// This software and related documentation is part of the Approximate
+// Nearest Neighbor Library (ANN).  This software is provided under
+// the provisions of the Lesser GNU Public License (LGPL).  See the
+// file ../ReadMe.txt for further information.
+//
+// The University of Maryland (U.M.) and the authors make no
+// representations about the suitability or fitness of this software for
+// any purpose.  It is provided "as is" without express or implied
+// warranty.
+//----------------------------------------------------------------------
+
+#include <vector>						// node array during construction
+
+#include "kd_flat.h"					// flat kd-tree declarations
+#include "kd_util.h"					// kd-tree utilities
+#include "pr_queue.h"					// priority queue
+#include "pr_queue_k.h"					// k-element priority queue
+#include <ANN/ANNperf.h>				// performance evaluation
+
+#if defined(ANN_SIMD_AVX)
+#include <immintrin.h>					// AVX intrinsics
+#elif defined(ANN_SIMD_SSE2)
+#include <emmintrin.h>					// SSE2 intrinsics
+#endif
+
+//----------------------------------------------------------------------
+//	rkd_flat - recursive procedure to build a flat kd-tree
+//		This is rkd_tree() with the nodes appended to an array instead
+//		of being allocated one by one.  A splitting node is appended
+//		before its children, and its low subtree is built before its
+//		high subtree, so the array ends up in preorder and the buckets
+//		of the leaves are consecutive pieces of pidx.
+//
+//		When the two subtrees of a large node are built in parallel
+//		(see kd_util.h), each is built into an array of its own, and
+//		the two are appended to the parent's array afterwards by
+//		annFlatAppend(), which shifts the child indices.
+//----------------------------------------------------------------------
+
+static int annFlatAppend(				// append subtree, return its index
+	vector<ANNkd_flatNode>	&nodes,		// nodes so far (modified)
+	vector<ANNkd_flatNode>	&sub)		// subtree to append
+{
+	int off = (int) nodes.size();		// index of its root
+	for (int i = 0; i < (int) sub.size(); i++) {
+		if (sub[i].cut_dim >= 0)		// splitting node: shift child
+			sub[i].link += off;
+		nodes.push_back(sub[i]);
+	}
+	return off;
+}
+
+static void rkd_flat(					// recursive construction of flat tree
+	ANNpointArray		pa,				// point array
+	ANNidxArray			pidx,			// point indices (whole array)
+	int					first,			// first index of this subtree
+	int					n,				// number of points
+	int					dim,			// dimension of space
+	int					bsp,			// bucket space
+	ANNorthRect			&bnd_box,		// bounding box for current node
+	ANNkd_splitter		splitter,		// splitting routine
+	int					level,			// depth of this node
+	int					&depth,			// height of tree (modified)
+	vector<ANNkd_flatNode> &nodes)		// nodes so far (modified)
+{
+	int id = (int) nodes.size();		// index of this node
+	nodes.push_back(ANNkd_flatNode());
+	if (level > depth) depth = level;
+
+	if (n <= bsp) {						// n small, make a leaf node
+		nodes[id].cut_val = 0;
+		nodes[id].cd_bnds[ANN_LO] = nodes[id].cd_bnds[ANN_HI] = 0;
+		nodes[id].cut_dim = ~n;			// mark leaf and its size
+		nodes[id].link = first;			// bucket is pidx[first..first+n-1]
+	}
+	else {								// n large, make a splitting node
+		int cd;							// cutting dimension
+		ANNcoord cv;					// cutting value
+		int n_lo;						// number on low side of cut
+
+										// invoke splitting procedure
+		(*splitter)(pa, pidx + first, bnd_box, n, dim, cd, cv, n_lo);
+
+		ANNcoord lv = bnd_box.lo[cd];	// save bounds for cutting dimension
+		ANNcoord hv = bnd_box.hi[cd];
+
+		int hi;							// index of high child
+
+#ifdef ANN_OMP_TASKS
+		if (n_lo >= ANN_PAR_BUILD && n-n_lo >= ANN_PAR_BUILD) {
+			vector<ANNkd_flatNode> lo_nodes, hi_nodes;	// subtrees
+			int lo_depth = 0, hi_depth = 0;
+										// build left subtree as a task
+			ANNorthRect lo_box(dim, bnd_box);	// ...with its own box
+			lo_box.hi[cd] = cv;
+#pragma omp task shared(lo_nodes, lo_depth, lo_box)
+			rkd_flat(pa, pidx, first, n_lo,
+					dim, bsp, lo_box, splitter, level+1, lo_depth, lo_nodes);
+
+			bnd_box.lo[cd] = cv;		// build right subtree meanwhile
+			rkd_flat(pa, pidx, first + n_lo, n-n_lo,
+					dim, bsp, bnd_box, splitter, level+1, hi_depth, hi_nodes);
+			bnd_box.lo[cd] = lv;		// restore bounds
+#pragma omp taskwait
+										// append them to our array
+			annFlatAppend(nodes, lo_nodes);
+			hi = annFlatAppend(nodes, hi_nodes);
+			if (lo_depth > depth) depth = lo_depth;
+			if (hi_depth > depth) depth = hi_depth;
+		}
+		else
+#endif
+		{
+			bnd_box.hi[cd] = cv;		// build left subtree
+			rkd_flat(pa, pidx, first, n_lo,
+					dim, bsp, bnd_box, splitter, level+1, depth, nodes);
+			bnd_box.hi[cd] = hv;		// restore bounds
+
+			hi = (int) nodes.size();	// high child comes next
+			bnd_box.lo[cd] = cv;		// build right subtree
+			rkd_flat(pa, pidx, first + n_lo, n-n_lo,
+					dim, bsp, bnd_box, splitter, level+1, depth, nodes);
+			bnd_box.lo[cd] = lv;		// restore bounds
+		}
+
+		nodes[id].cut_val = cv;			// fill in the splitting node
+		nodes[id].cd_bnds[ANN_LO] = lv;
+		nodes[id].cd_bnds[ANN_HI] = hv;
+		nodes[id].cut_dim = cd;
+		nodes[id].link = hi;
+	}
+}
+
+ANNkd_flat::ANNkd_flat(					// build from point array
+	ANNpointArray		pa,				// point array (unaltered)
+	ANNidxArray			pi,				// point indices (permuted)
+	int					n,				// number of points
+	int					dim,			// dimension of space
+	int					bsp,			// bucket space
+	ANNorthRect			&bnd_box,		// bounding box for points
+	ANNkd_splitter		splitter)		// splitting routine
+{
+	vector<ANNkd_flatNode> tmp;			// nodes as they are built
+	tmp.reserve(2*(n/bsp) + 1);			// typical size of the tree
+
+	depth = 0;
+	pidx = pi;
+	owner = ANNtrue;
+	rkd_flat(pa, pidx, 0, n, dim, bsp, bnd_box, splitter, 0, depth, tmp);
+
+	n_nodes = (int) tmp.size();			// copy to an exact-size array
+	nodes = new ANNkd_flatNode[n_nodes];
+	for (int i = 0; i < n_nodes; i++) {
+		nodes[i] = tmp[i];
+	}
+										// copy coordinates in leaf order
+	coords = new ANNcoord[n > 0 ? n*dim : 1];
+	for (int i = 0; i < n_nodes; i++) {
+		if (nodes[i].cut_dim >= 0) continue;
+		int m = ~nodes[i].cut_dim;		// points in this bucket
+		int first = nodes[i].link;
+		ANNcoord *blk = coords + first*dim;
+		for (int d = 0; d < dim; d++) {
+			for (int j = 0; j < m; j++) {
+				blk[d*m + j] = pa[pidx[first + j]][d];
+			}
+		}
+	}
+}
+
+//----------------------------------------------------------------------
+//	Search stack
+//		The subtrees still to be visited by ann_search() and
+//		ann_FR_search().  For trees of the usual height this lives on
+//		the C stack, so that a search does not allocate anything.
+//----------------------------------------------------------------------
+
+struct ANNflatItem {					// subtree waiting to be visited
+	int					node;			// index of its root
+	ANNdist				dist;			// distance to its cell
+};
+
+class ANNflatStack {					// stack of waiting subtrees
+	ANNflatItem			local[ANN_FLAT_STACK];	// storage for short stacks
+	ANNflatItem			*items;			// the stack
+public:
+	ANNflatStack(int depth)				// constructor (given tree height)
+		{
+			if (depth < ANN_FLAT_STACK) items = local;
+			else items = new ANNflatItem[depth+1];
+		}
+	~ANNflatStack()						// destructor
+		{  if (items != local) delete [] items;  }
+	ANNflatItem& operator[](int i)		// i-th entry
+		{  return items[i];  }
+};
+
+//----------------------------------------------------------------------
+//	Leaf distance kernels
+//		annFlatDist4() computes the squared distances from q to four
+//		consecutive points of a bucket, and annFlatDist1() to a single
+//		one.  blk points to the x-coordinate of the (first) point and
+//		m is the number of points in the bucket, which is the distance
+//		from one coordinate of a point to the next.  Unlike the node
+//		layout there is no early exit once the distance exceeds the
+//		current bound: for the short vectors of low dimensions, the
+//		test costs more than the arithmetic it saves.
+//----------------------------------------------------------------------
+
+inline void annFlatDist4(
+	const ANNcoord		*blk,			// first coordinate of first point
+	int					m,				// points in bucket (stride)
+	const ANNcoord		*q,				// query point
+	int					dim,			// dimension of space
+	ANNdist				*dd)			// the four distances (returned)
+{
+#if defined(ANN_SIMD_AVX)
+	__m256d acc = _mm256_setzero_pd();
+	for (int d = 0; d < dim; d++, blk += m) {
+		__m256d t = _mm256_sub_pd(_mm256_set1_pd(q[d]), _mm256_loadu_pd(blk));
+		acc = _mm256_add_pd(acc, _mm256_mul_pd(t, t));
+	}
+	_mm256_storeu_pd(dd, acc);
+#elif defined(ANN_SIMD_SSE2)
+	__m128d acc0 = _mm_setzero_pd();	// points 0 and 1
+	__m128d acc1 = _mm_setzero_pd();	// points 2 and 3
+	for (int d = 0; d < dim; d++, blk += m) {
+		__m128d qd = _mm_set1_pd(q[d]);
+		__m128d t0 = _mm_sub_pd(qd, _mm_loadu_pd(blk));
+		__m128d t1 = _mm_sub_pd(qd, _mm_loadu_pd(blk + 2));
+		acc0 = _mm_add_pd(acc0, _mm_mul_pd(t0, t0));
+		acc1 = _mm_add_pd(acc1, _mm_mul_pd(t1, t1));
+	}
+	_mm_storeu_pd(dd, acc0);
+	_mm_storeu_pd(dd + 2, acc1);
+#else
+	dd[0] = dd[1] = dd[2] = dd[3] = 0;
+	for (int d = 0; d < dim; d++, blk += m) {
+		for (int l = 0; l < 4; l++) {
+			ANNcoord t = q[d] - blk[l];
+			dd[l] = ANN_SUM(dd[l], ANN_POW(t));
+		}
+	}
+#endif
+	ANN_COORD(4*dim)					// coordinates hit
+	ANN_FLOP(12*dim)					// increment floating ops
+}
+
+inline ANNdist annFlatDist1(
+	const ANNcoord		*blk,			// first coordinate of point
+	int					m,				// points in bucket (stride)
+	const ANNcoord		*q,				// query point
+	int					dim)			// dimension of space
+{
+	ANNdist dist = 0;
+	for (int d = 0; d < dim; d++, blk += m) {
+		ANNcoord t = q[d] - *blk;
+		dist = ANN_SUM(dist, ANN_POW(t));
+	}
+	ANN_COORD(dim)						// coordinates hit
+	ANN_FLOP(3*dim)						// increment floating ops
+	return dist;
+}
+
+//----------------------------------------------------------------------
+//	annFlatLeafSearch - search points in a leaf node
+//		This is ANNkd_leaf::ann_search() for a flat leaf.  The points
+//		are taken four at a time, and the few left over one by one.
+//		For k = 1 (ONE) the closest point of the bucket is kept in
+//		registers and only that one is inserted, at the end.
+//----------------------------------------------------------------------
+
+template <bool ONE>
+inline void annFlatLeafSearch(
+	ANNkd_flatNode		*np,			// the leaf
+	ANNkd_flat			&fl,			// the tree
+	ANNsearchCtx		&ctx)			// search state
+{
+	int n_pts = ~np->cut_dim;			// no. points in bucket
+	ANNidxArray bkt = fl.pidx + np->link;	// their indices
+	ANNcoord *blk = fl.coords + np->link*ctx.dim;// and coordinates
+	ANNdist dd[4];						// distances of four points
+										// k-th smallest distance so far
+	ANNdist min_dist = ctx.pointMK->max_key();
+	int best = -1;						// closest in bucket (if ONE)
+	int hit = 0;						// did we add a point?
+
+	int i = 0;
+	for ( ; i + 4 <= n_pts; i += 4) {	// four points at a time
+		annFlatDist4(blk + i, n_pts, ctx.q, ctx.dim, dd);
+		for (int l = 0; l < 4; l++) {
+			if (dd[l] <= min_dist &&				// among the k best?
+			   (ANN_ALLOW_SELF_MATCH || dd[l]!=0)) {// and no self-match
+				if (ONE) {							// closest so far
+					if (best < 0 || dd[l] < min_dist) {
+						best = i+l;
+						min_dist = dd[l];
+					}
+				}
+				else {
+					ctx.pointMK->insert(dd[l], bkt[i+l]);
+					min_dist = ctx.pointMK->max_key();
+					hit = 1;
+				}
+			}
+		}
+	}
+	for ( ; i < n_pts; i++) {			// the rest one at a time
+		ANNdist dist = annFlatDist1(blk + i, n_pts, ctx.q, ctx.dim);
+		if (dist <= min_dist &&
+		   (ANN_ALLOW_SELF_MATCH || dist!=0)) {
+			if (ONE) {
+				if (best < 0 || dist < min_dist) {
+					best = i;
+					min_dist = dist;
+				}
+			}
+			else {
+				ctx.pointMK->insert(dist, bkt[i]);
+				min_dist = ctx.pointMK->max_key();
+				hit = 1;
+			}
+		}
+	}
+	if (ONE && best >= 0) {				// add the closest one
+		ctx.pointMK->insert(min_dist, bkt[best]);
+		hit = 1;
+	}
+
+	ANN_LEAF(1)							// one more leaf node visited
+	ANN_PTS(n_pts)						// increment points visited
+	ctx.ptsVisited += n_pts;			// increment number of points visited
+	ctx.lfVisited++;					// ...counted in the search state
+	ctx.lfHits += hit;					// and whether it added a point
+}
+
+//----------------------------------------------------------------------
+//	annFlatLeafFRSearch - search points in a leaf node
+//		This is ANNkd_leaf::ann_FR_search() for a flat leaf.
+//----------------------------------------------------------------------
+
+inline void annFlatLeafFRSearch(
+	ANNkd_flatNode		*np,			// the leaf
+	ANNkd_flat			&fl,			// the tree
+	ANNsearchCtx		&ctx)			// search state
+{
+	int n_pts = ~np->cut_dim;			// no. points in bucket
+	ANNidxArray bkt = fl.pidx + np->link;	// their indices
+	ANNcoord *blk = fl.coords + np->link*ctx.dim;// and coordinates
+	ANNdist dd[4];						// distances of four points
+	int in_range = ctx.ptsInRange;		// points in range so far
+
+	int i = 0;
+	for ( ; i + 4 <= n_pts; i += 4) {	// four points at a time
+		annFlatDist4(blk + i, n_pts, ctx.q, ctx.dim, dd);
+		for (int l = 0; l < 4; l++) {
+			if (dd[l] <= ctx.sqRad &&				// within the radius?
+			   (ANN_ALLOW_SELF_MATCH || dd[l]!=0)) {// and no self-match
+				ctx.pointMK->insert(dd[l], bkt[i+l]);
+				ctx.ptsInRange++;
+			}
+		}
+	}
+	for ( ; i < n_pts; i++) {			// the rest one at a time
+		ANNdist dist = annFlatDist1(blk + i, n_pts, ctx.q, ctx.dim);
+		if (dist <= ctx.sqRad &&
+		   (ANN_ALLOW_SELF_MATCH || dist!=0)) {
+			ctx.pointMK->insert(dist, bkt[i]);
+			ctx.ptsInRange++;
+		}
+	}
+	ANN_LEAF(1)							// one more leaf node visited
+	ANN_PTS(n_pts)						// increment points visited
+	ctx.ptsVisited += n_pts;			// increment number of points visited
+	ctx.lfVisited++;					// ...counted in the search state
+	ctx.lfHits += (ctx.ptsInRange > in_range);	// and whether it added one
+}
+
+//----------------------------------------------------------------------
+//	ann_search - standard search of a flat tree
+//		The subtrees are visited in the same order as by the recursive
+//		search (see kd_search.cpp).  Instead of recursing into the
+//		closer child and deciding on the further child afterwards, we
+//		push the further child with the distance to its cell, continue
+//		down the closer one, and decide when the further child is
+//		popped, by which time the closer subtree has been searched.
+//----------------------------------------------------------------------
+
+void ANNkd_flat::ann_search(ANNdist box_dist, ANNsearchCtx &ctx)
+{
+	ANNflatStack stk(depth);			// subtrees to visit
+	int sp = 0;							// stack size
+
+	stk[sp].node = 0;					// start with the root
+	stk[sp].dist = box_dist;
+	sp++;
+
+	while (sp > 0) {
+										// check dist calc term condition
+		if (ctx.maxPtsVisited != 0 && ctx.ptsVisited > ctx.maxPtsVisited) break;
+
+		sp--;							// pop next subtree
+		box_dist = stk[sp].dist;
+										// skip it unless close enough
+		if (box_dist * ctx.maxErr >= ctx.pointMK->max_key())
+			continue;
+
+		register ANNkd_flatNode *np = nodes + stk[sp].node;
+		while (np->cut_dim >= 0) {		// descend to a leaf
+			int cd = np->cut_dim;
+			int near, far;				// closer and further child
+										// distance to cutting plane
+			ANNcoord cut_diff = ctx.q[cd] - np->cut_val;
+			ANNcoord box_diff;
+
+			if (cut_diff < 0) {			// left of cutting plane
+				near = (int) (np - nodes) + 1;
+				far = np->link;
+				box_diff = np->cd_bnds[ANN_LO] - ctx.q[cd];
+			}
+			else {						// right of cutting plane
+				near = np->link;
+				far = (int) (np - nodes) + 1;
+				box_diff = ctx.q[cd] - np->cd_bnds[ANN_HI];
+			}
+			if (box_diff < 0)			// within bounds - ignore
+				box_diff = 0;
+										// push further child
+			stk[sp].node = far;
+			stk[sp].dist = (ANNdist) ANN_SUM(box_dist,
+					ANN_DIFF(ANN_POW(box_diff), ANN_POW(cut_diff)));
+			sp++;
+
+			np = nodes + near;			// continue with closer child
+			ANN_FLOP(10)				// increment floating ops
+			ANN_SPL(1)					// one more splitting node visited
+			ctx.splVisited++;			// ...counted in the search state
+		}
+		if (ctx.pointMK->max_k() == 1)	// leaf loop for k = 1
+			annFlatLeafSearch<true>(np, *this, ctx);
+		else
+			annFlatLeafSearch<false>(np, *this, ctx);
+	}
+}
+
+//----------------------------------------------------------------------
+//	ann_pri_search - priority search of a flat tree
+//		The same as annkPriSearch() and ANNkd_split::ann_pri_search()
+//		(see kd_pr_search.cpp), except that the boxes in the priority
+//		queue are pointers into the node array.  The caller provides
+//		the queue in ctx.boxPQ.
+//----------------------------------------------------------------------
+
+void ANNkd_flat::ann_pri_search(ANNdist box_dist, ANNsearchCtx &ctx)
+{
+	ctx.boxPQ->insert(box_dist, nodes);	// insert root in priority queue
+
+	while (ctx.boxPQ->non_empty() &&
+		(!(ctx.maxPtsVisited != 0 && ctx.ptsVisited > ctx.maxPtsVisited))) {
+		ANNkd_flatNode *np;				// next box from prior queue
+
+										// extract closest box from queue
+		ctx.boxPQ->extr_min(box_dist, (void *&) np);
+
+		ANN_FLOP(2)						// increment floating ops
+		if (box_dist*ctx.maxErr >= ctx.pointMK->max_key())
+			break;
+
+		while (np->cut_dim >= 0) {		// descend to a leaf
+			int cd = np->cut_dim;
+			ANNkd_flatNode *near, *far;	// closer and further child
+										// distance to cutting plane
+			ANNcoord cut_diff = ctx.q[cd] - np->cut_val;
+			ANNcoord box_diff;
+
+			if (cut_diff < 0) {			// left of cutting plane
+				near = np + 1;
+				far = nodes + np->link;
+				box_diff = np->cd_bnds[ANN_LO] - ctx.q[cd];
+			}
+			else {						// right of cutting plane
+				near = nodes + np->link;
+				far = np + 1;
+				box_diff = ctx.q[cd] - np->cd_bnds[ANN_HI];
+			}
+			if (box_diff < 0)			// within bounds - ignore
+				box_diff = 0;
+										// distance to further box
+			ANNdist new_dist = (ANNdist) ANN_SUM(box_dist,
+					ANN_DIFF(ANN_POW(box_diff), ANN_POW(cut_diff)));
+
+			if (far->cut_dim != ~0)		// enqueue if not trivial
+				ctx.boxPQ->insert(new_dist, far);
+
+			np = near;					// continue with closer child
+			ANN_SPL(1)					// one more splitting node visited
+			ctx.splVisited++;			// ...counted in the search state
+			ANN_FLOP(8)					// increment floating ops
+		}
+		if (ctx.pointMK->max_k() == 1)	// leaf loop for k = 1
+			annFlatLeafSearch<true>(np, *this, ctx);
+		else
+			annFlatLeafSearch<false>(np, *this, ctx);
+	}
+}
+
+//----------------------------------------------------------------------
+//	ann_FR_search - fixed-radius search of a flat tree
+//		This is ann_search() with the pruning test of
+//		ANNkd_split::ann_FR_search() (see kd_fix_rad_search.cpp).
+//----------------------------------------------------------------------
+
+void ANNkd_flat::ann_FR_search(ANNdist box_dist, ANNsearchCtx &ctx)
+{
+	ANNflatStack stk(depth);			// subtrees to visit
+	int sp = 0;							// stack size
+
+	stk[sp].node = 0;					// start with the root
+	stk[sp].dist = box_dist;
+	sp++;
+
+	while (sp > 0) {
+										// check dist calc term condition
+		if (ctx.maxPtsVisited != 0 && ctx.ptsVisited > ctx.maxPtsVisited) break;
+
+		sp--;							// pop next subtree
+		box_dist = stk[sp].dist;
+										// skip it unless in range
+		if (box_dist * ctx.maxErr > ctx.sqRad)
+			continue;
+
+		register ANNkd_flatNode *np = nodes + stk[sp].node;
+		while (np->cut_dim >= 0) {		// descend to a leaf
+			int cd = np->cut_dim;
+			int near, far;				// closer and further child
+										// distance to cutting plane
+			ANNcoord cut_diff = ctx.q[cd] - np->cut_val;
+			ANNcoord box_diff;
+
+			if (cut_diff < 0) {			// left of cutting plane
+				near = (int) (np - nodes) + 1;
+				far = np->link;
+				box_diff = np->cd_bnds[ANN_LO] - ctx.q[cd];
+			}
+			else {						// right of cutting plane
+				near = np->link;
+				far = (int) (np - nodes) + 1;
+				box_diff = ctx.q[cd] - np->cd_bnds[ANN_HI];
+			}
+			if (box_diff < 0)			// within bounds - ignore
+				box_diff = 0;
+										// push further child
+			stk[sp].node = far;
+			stk[sp].dist = (ANNdist) ANN_SUM(box_dist,
+					ANN_DIFF(ANN_POW(box_diff), ANN_POW(cut_diff)));
+			sp++;
+
+			np = nodes + near;			// continue with closer child
+			ANN_FLOP(13)				// increment floating ops
+			ANN_SPL(1)					// one more splitting node visited
+			ctx.splVisited++;			// ...counted in the search state
+		}
+
+		annFlatLeafFRSearch(np, *this, ctx);
+	}
+}
+
+//----------------------------------------------------------------------
+//	Statistics, printing and dumping
+//		These produce the same output as the corresponding routines
+//		for the node layout (see kd_tree.cpp and kd_dump.cpp).  Since
+//		the nodes are stored in preorder, the dump is a simple scan of
+//		the array, and a tree that has been dumped from the flat layout
+//		is loaded by the usual load constructor.
+//----------------------------------------------------------------------
+
+const double ANN_AR_TOOBIG = 1000;		// too big an aspect ratio
+
+static void annFlatStats(				// get subtree statistics
+	ANNkd_flatNode		*nodes,			// the nodes
+	int					i,				// root of subtree
+	int					dim,			// dimension of space
+	ANNkdStats			&st,			// stats (modified)
+	ANNorthRect			&bnd_box)		// bounding box
+{
+	ANNkd_flatNode *np = nodes + i;
+	st.reset();
+	if (np->cut_dim < 0) {				// leaf
+		st.n_lf = 1;					// count this leaf
+		if (np->cut_dim == ~0) st.n_tl = 1;	// count trivial leaf
+		double ar = annAspectRatio(dim, bnd_box);
+										// incr sum (ignore outliers)
+		st.sum_ar += float(ar < ANN_AR_TOOBIG ? ar : ANN_AR_TOOBIG);
+		return;
+	}
+	int cd = np->cut_dim;
+	ANNkdStats ch_stats;				// stats for children
+
+	ANNcoord hv = bnd_box.hi[cd];		// stats for low child
+	bnd_box.hi[cd] = np->cut_val;
+	annFlatStats(nodes, i+1, dim, ch_stats, bnd_box);
+	st.merge(ch_stats);
+	bnd_box.hi[cd] = hv;
+
+	ANNcoord lv = bnd_box.lo[cd];		// stats for high child
+	bnd_box.lo[cd] = np->cut_val;
+	annFlatStats(nodes, np->link, dim, ch_stats, bnd_box);
+	st.merge(ch_stats);
+	bnd_box.lo[cd] = lv;
+
+	st.depth++;							// increment depth
+	st.n_spl++;							// increment number of splits
+}
+
+void ANNkd_flat::getStats(				// get tree statistics
+	int					dim,			// dimension of space
+	ANNkdStats			&st,			// stats (modified)
+	ANNorthRect			&bnd_box)		// bounding box
+{
+	annFlatStats(nodes, 0, dim, st, bnd_box);
+}
+
+static void annFlatPrint(				// print subtree
+	ANNkd_flatNode		*nodes,			// the nodes
+	ANNidxArray			pidx,			// point indices
+	int					i,				// root of subtree
+	int					level,			// depth of node in tree
+	ostream				&out)			// output stream
+{
+	ANNkd_flatNode *np = nodes + i;
+	if (np->cut_dim >= 0)				// print high child
+		annFlatPrint(nodes, pidx, np->link, level+1, out);
+
+	out << "    ";
+	for (int j = 0; j < level; j++)		// print indentation
+		out << "..";
+
+	if (np->cut_dim >= 0) {				// splitting node
+		out << "Split cd=" << np->cut_dim << " cv=" << np->cut_val;
+		out << " lbnd=" << np->cd_bnds[ANN_LO];
+		out << " hbnd=" << np->cd_bnds[ANN_HI];
+		out << "\n";
+		annFlatPrint(nodes, pidx, i+1, level+1, out);	// print low child
+	}
+	else if (np->cut_dim == ~0) {		// trivial leaf
+		out << "Leaf (trivial)\n";
+	}
+	else {
+		int n_pts = ~np->cut_dim;
+		out << "Leaf n=" << n_pts << " <";
+		for (int j = 0; j < n_pts; j++) {
+			out << pidx[np->link + j];
+			if (j < n_pts-1) out << ",";
+		}
+		out << ">\n";
+	}
+}
+
+void ANNkd_flat::print(					// print tree
+	ostream				&out)			// output stream
+{
+	annFlatPrint(nodes, pidx, 0, 0, out);
+}
+
+void ANNkd_flat::dump(					// dump tree
+	ostream				&out)			// output stream
+{
+	for (int i = 0; i < n_nodes; i++) {	// nodes are in preorder
+		ANNkd_flatNode *np = nodes + i;
+		if (np->cut_dim >= 0) {
+			out << "split " << np->cut_dim << " " << np->cut_val << " ";
+			out << np->cd_bnds[ANN_LO] << " " << np->cd_bnds[ANN_HI] << "\n";
+		}
+		else {
+			int n_pts = ~np->cut_dim;
+			out << "leaf " << n_pts;
+			for (int j = 0; j < n_pts; j++) {
+				out << " " << pidx[np->link + j];
+			}
+			out << "\n";
+		}
+	}
+}
@@ -0,0 +1,147 @@
+//----------------------------------------------------------------------
+// File:			kd_flat.h
+// Description:		Declarations for the flat kd-tree layout
+//----------------------------------------------------------------------
+// Copyright (c) 1997-2005 University of Maryland and Sunil Arya and
+// David Mount.  All Rights Reserved.
+//
+// This software and related documentation is part of the Approximate
+// Nearest Neighbor Library (ANN).  This software is provided under
+// the provisions of the Lesser GNU Public License (LGPL).  See the
+// file ../ReadMe.txt for further information.
+//
+// The University of Maryland (U.M.) and the authors make no
+// representations about the suitability or fitness of this software for
+// any purpose.  It is provided "as is" without express or implied
+// warranty.
+//----------------------------------------------------------------------
+
+#ifndef ANN_kd_flat_H
+#define ANN_kd_flat_H
+
+#include "kd_tree.h"					// kd-tree declarations
+
+//----------------------------------------------------------------------
+//	Flat kd-tree nodes
+//		In the flat layout (ANN_LAYOUT_FLAT) the nodes of a kd-tree
+//		are not separate objects, but entries of a single array,
+//		stored in preorder.  The low child of a splitting node is the
+//		entry immediately following it, and the node stores the index
+//		of its high child.  A node is 32 bytes, so that two of them
+//		share a cache line and a descent touches memory in increasing
+//		address order.
+//
+//		A leaf is marked by a negative cut_dim, which holds ~n_pts
+//		(that is, -1-n_pts).  For a leaf, link is the index in the
+//		point index array (pidx) of the first point of its bucket.
+//		Since the builder stores buckets in preorder, these are just
+//		consecutive pieces of pidx.  There is no shared trivial leaf:
+//		an empty leaf is a leaf with n_pts = 0.
+//
+//		The coordinates of the points are also copied into the tree,
+//		in leaf order and "structure of arrays" form: the bucket
+//		starting at pidx[first] with m points has its coordinates at
+//		coords[first*dim ...], first the m x-coordinates, then the m
+//		y-coordinates, and so on.  A leaf is searched by a single pass
+//		over this block, several points at a time (see kd_flat.cpp),
+//		without going through pidx and pts.
+//----------------------------------------------------------------------
+
+class ANNkd_flatNode {					// node of a flat kd-tree
+public:
+	ANNcoord			cut_val;		// location of cutting plane
+	ANNcoord			cd_bnds[2];		// lower and upper bounds of
+										// rectangle along cut_dim
+	int					cut_dim;		// cutting dim (~n_pts for a leaf)
+	int					link;			// split: index of high child
+										// leaf: index of bucket in pidx
+};
+
+//----------------------------------------------------------------------
+//	Flat kd-tree
+//		An ANNkd_flat holds the node array of a flat kd-tree together
+//		with a (borrowed) pointer to the point index array of the
+//		ANNkd_tree that owns it.  It is built directly from the
+//		points by the same splitting rules as rkd_tree(), so the two
+//		layouts describe exactly the same subdivision.
+//
+//		Searching is done by a loop rather than by recursion.  The
+//		subtrees which remain to be visited (the further children of
+//		the splitting nodes on the current path) are kept on an
+//		explicit stack, together with the distance to their cells.
+//		The stack never holds more than depth entries, where depth is
+//		the height of the tree, which is recorded when it is built.
+//
+//		A flat tree may also be made from arrays that belong to
+//		someone else, namely a binary image of the tree which has been
+//		mapped into memory (see kd_image.cpp).  Then owner is false,
+//		and the arrays are not deleted with the tree.
+//----------------------------------------------------------------------
+
+const int ANN_FLAT_STACK = 64;			// stack entries kept on the C stack
+
+//----------------------------------------------------------------------
+//	SIMD distance kernels
+//		Leaves are searched four points at a time.  If the compiler
+//		targets AVX (e.g. -mavx2, /arch:AVX2) the four distances are
+//		computed in one 256-bit register, with SSE2 (any x86-64
+//		target) in two 128-bit registers, and otherwise by plain C++.
+//		Defining ANN_NO_SIMD forces the plain version.  The kernels
+//		assume the Euclidean metric (ANN_POW(v) = v*v) and double
+//		coordinates, which are the ANN defaults.
+//----------------------------------------------------------------------
+
+#if !defined(ANN_NO_SIMD)
+	#if defined(__AVX__)
+		#define ANN_SIMD_AVX
+	#elif defined(__SSE2__) || defined(_M_X64) || \
+			(defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+		#define ANN_SIMD_SSE2
+	#endif
+#endif
+
+class ANNkd_flat {						// flat kd-tree
+public:
+	int					n_nodes;		// number of nodes
+	int					depth;			// height of the tree
+	ANNkd_flatNode		*nodes;			// the nodes (in preorder)
+	ANNidxArray			pidx;			// point indices (borrowed)
+	ANNcoord			*coords;		// coordinates in leaf order
+	ANNbool				owner;			// do we delete nodes and coords?
+
+	ANNkd_flat(							// build from point array
+		ANNpointArray	pa,				// point array (unaltered)
+		ANNidxArray		pi,				// point indices (permuted)
+		int				n,				// number of points
+		int				dim,			// dimension of space
+		int				bsp,			// bucket space
+		ANNorthRect		&bnd_box,		// bounding box for points
+		ANNkd_splitter	splitter);		// splitting routine
+
+	ANNkd_flat(							// use existing arrays (borrowed)
+		int				nn,				// number of nodes
+		int				dp,				// height of the tree
+		ANNkd_flatNode	*nd,			// the nodes
+		ANNidxArray		pi,				// point indices
+		ANNcoord		*cc)			// coordinates in leaf order
+		{
+			n_nodes = nn;  depth = dp;  nodes = nd;
+			pidx = pi;  coords = cc;  owner = ANNfalse;
+		}
+
+	~ANNkd_flat()						// destructor
+		{  if (owner) {  delete [] nodes;  delete [] coords;  }  }
+
+	void ann_search(ANNdist, ANNsearchCtx&);	// standard search
+	void ann_pri_search(ANNdist, ANNsearchCtx&);// priority search
+	void ann_FR_search(ANNdist, ANNsearchCtx&);	// fixed-radius search
+
+	void getStats(						// get tree statistics
+		int				dim,			// dimension of space
+		ANNkdStats		&st,			// statistics
+		ANNorthRect		&bnd_box);		// bounding box
+	void print(ostream &out);			// print tree
+	void dump(ostream &out);			// dump tree
+};
+
+#endif
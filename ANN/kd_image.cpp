@@ -0,0 +1,356 @@
+//----------------------------------------------------------------------
+// File:			kd_image.cpp
+// Description:		Binary images of flat kd-trees
+//----------------------------------------------------------------------
+// Copyright (c) 1997-2005 University of Maryland and Sunil Arya and
+// David Mount.  All Rights Reserved.
+//
+// This software and related documentation is part of the Approximate
+// Nearest Neighbor Library (ANN).  This software is provided under
+// the provisions of the Lesser GNU Public License (LGPL).  See the
+// file ../ReadMe.txt for further information.
+//
+// The University of Maryland (U.M.) and the authors make no
+// representations about the suitability or fitness of this software for
+// any purpose.  It is provided "as is" without express or implied
+// warranty.
+//----------------------------------------------------------------------
+// This file contains routines for saving kd-trees in the flat layout
+// as binary images, and for loading them again by mapping the image
+// into memory.  Unlike the dump format (see kd_dump.cpp), which is
+// text and has to be parsed, an image holds the arrays of the tree as
+// they are in memory, so that the loaded tree searches the file
+// itself.  The only work per point at load time is to set up the
+// array of pointers to the points (ANNpointArray), which cannot be
+// stored in a file and takes one pointer per point; the nodes, buckets
+// and coordinates are not copied, and the pages of the file are only
+// read as the searches need them.
+//----------------------------------------------------------------------
+
+#include <cstring>						// memcmp, memset
+
+#if defined(_WIN32)
+	#ifndef WIN32_LEAN_AND_MEAN
+		#define WIN32_LEAN_AND_MEAN
+	#endif
+	#ifndef NOMINMAX
+		#define NOMINMAX
+	#endif
+	#include <windows.h>				// CreateFileMapping, MapViewOfFile
+#else
+	#include <fcntl.h>					// open
+	#include <unistd.h>					// close
+	#include <sys/mman.h>				// mmap, munmap
+	#include <sys/stat.h>				// fstat
+#endif
+
+#include "kd_tree.h"					// kd-tree declarations
+#include "kd_flat.h"					// flat kd-tree declarations
+#include "kd_util.h"					// kd-tree utilities
+
+using namespace std;					// make std:: available
+
+//----------------------------------------------------------------------
+//	ANN Binary Image Format
+//		An image is a header followed by the arrays of the tree, each
+//		of which starts at a multiple of ANN_IMG_ALIGN bytes from the
+//		start of the file (so that the arrays are aligned when the
+//		file is mapped, which is at a page boundary).  The arrays are:
+//
+//		box		bounding box: dim low, then dim high coordinates
+//		nodes	n_nodes flat nodes, in preorder (see kd_flat.h)
+//		pidx	n_pts point indices, buckets in preorder
+//		coords	n_pts*dim coordinates in leaf order (see kd_flat.h)
+//		pts		n_pts*dim coordinates of the points, in the order of
+//				their indices (point i at pts[i*dim])
+//
+//		Numbers are stored in the byte order of the machine which
+//		wrote them.  The header records this order, and the sizes of
+//		the types involved, so that an image is only loaded by a
+//		program which has the same memory layout, and otherwise
+//		rejected.  The version is incremented whenever the layout of
+//		the header or of the nodes changes.
+//
+//		The header (and that the sections are inside the file) is all
+//		that is checked when an image is loaded.  The contents of the
+//		arrays are trusted, as they are never read until the tree is
+//		searched.
+//----------------------------------------------------------------------
+
+const int		ANN_IMG_VERSION		= 1;	// version of the format
+const int		ANN_IMG_ALIGN		= 64;	// alignment of sections
+const int		ANN_IMG_BYTE_ORDER	= 0x01020304;	// read as written?
+const char		ANN_IMG_MAGIC[8]	= "ANNflat";	// begins the file
+
+enum {									// sections of the file
+		ANN_IMG_BOX				= 0,	// bounding box
+		ANN_IMG_NODES			= 1,	// flat nodes
+		ANN_IMG_PIDX			= 2,	// point indices
+		ANN_IMG_COORDS			= 3,	// coordinates in leaf order
+		ANN_IMG_PTS				= 4,	// coordinates in index order
+		ANN_IMG_N_SECTIONS		= 5};	// number of sections
+
+struct ANNimageHeader {					// header of a binary image
+	char				magic[8];		// ANN_IMG_MAGIC
+	int					version;		// ANN_IMG_VERSION
+	int					byte_order;		// ANN_IMG_BYTE_ORDER
+	int					coord_size;		// sizeof(ANNcoord)
+	int					idx_size;		// sizeof(ANNidx)
+	int					node_size;		// sizeof(ANNkd_flatNode)
+	int					dim;			// dimension of space
+	int					n_pts;			// number of points
+	int					bkt_size;		// bucket size
+	int					n_nodes;		// number of nodes
+	int					depth;			// height of the tree
+	long long			offset[ANN_IMG_N_SECTIONS];	// start of sections
+	long long			size;			// size of the file
+};
+
+//----------------------------------------------------------------------
+//	annImageLayout - fill in the header for a tree
+//		This sets the sizes and the offsets of the sections.  It is
+//		used both when writing an image, and when loading one, to
+//		check its header against what it should be.
+//----------------------------------------------------------------------
+
+static void annImageLayout(				// set up header for a tree
+	ANNimageHeader		&hdr,			// header (modified)
+	int					dim,			// dimension of space
+	int					n_pts,			// number of points
+	int					bkt_size,		// bucket size
+	int					n_nodes,		// number of nodes
+	int					depth)			// height of the tree
+{
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, ANN_IMG_MAGIC, sizeof(hdr.magic));
+	hdr.version = ANN_IMG_VERSION;
+	hdr.byte_order = ANN_IMG_BYTE_ORDER;
+	hdr.coord_size = (int) sizeof(ANNcoord);
+	hdr.idx_size = (int) sizeof(ANNidx);
+	hdr.node_size = (int) sizeof(ANNkd_flatNode);
+	hdr.dim = dim;
+	hdr.n_pts = n_pts;
+	hdr.bkt_size = bkt_size;
+	hdr.n_nodes = n_nodes;
+	hdr.depth = depth;
+
+	long long len[ANN_IMG_N_SECTIONS];	// lengths of the sections
+	len[ANN_IMG_BOX] = 2LL*dim*sizeof(ANNcoord);
+	len[ANN_IMG_NODES] = (long long) n_nodes*sizeof(ANNkd_flatNode);
+	len[ANN_IMG_PIDX] = (long long) n_pts*sizeof(ANNidx);
+	len[ANN_IMG_COORDS] = (long long) n_pts*dim*sizeof(ANNcoord);
+	len[ANN_IMG_PTS] = (long long) n_pts*dim*sizeof(ANNcoord);
+
+	long long pos = sizeof(ANNimageHeader);
+	for (int s = 0; s < ANN_IMG_N_SECTIONS; s++) {
+										// round up to alignment
+		pos = (pos + ANN_IMG_ALIGN-1) / ANN_IMG_ALIGN * ANN_IMG_ALIGN;
+		hdr.offset[s] = pos;
+		pos += len[s];
+	}
+	hdr.size = pos;
+}
+
+//----------------------------------------------------------------------
+//	Save - write binary image of a tree
+//		The tree must be in the flat layout (or empty).  The stream
+//		should have been opened in binary mode (ios::binary), so that
+//		nothing is translated on its way to the file.
+//----------------------------------------------------------------------
+
+static void annImagePad(				// pad output to given position
+	ostream				&out,			// output stream
+	long long			&pos,			// current position (modified)
+	long long			to)				// position to pad to
+{
+	static const char zeros[ANN_IMG_ALIGN] = {0};
+	while (pos < to) {
+		int m = (to - pos < ANN_IMG_ALIGN ? (int) (to - pos) : ANN_IMG_ALIGN);
+		out.write(zeros, m);
+		pos += m;
+	}
+}
+
+void ANNkd_tree::Save(					// save binary image of tree
+	ostream				&out)			// output stream
+{
+	if (flat == NULL && n_pts > 0) {
+		annError("Only trees in the flat layout can be saved", ANNabort);
+	}
+	ANNimageHeader hdr;
+	annImageLayout(hdr, dim, n_pts, bkt_size,
+			flat != NULL ? flat->n_nodes : 0,
+			flat != NULL ? flat->depth : 0);
+
+	long long pos = 0;					// where we are in the file
+	out.write((const char*) &hdr, sizeof(hdr));
+	pos += sizeof(hdr);
+
+	annImagePad(out, pos, hdr.offset[ANN_IMG_BOX]);
+	if (bnd_box_lo != NULL) {			// bounding box
+		out.write((const char*) bnd_box_lo, dim*sizeof(ANNcoord));
+		out.write((const char*) bnd_box_hi, dim*sizeof(ANNcoord));
+		pos += 2LL*dim*sizeof(ANNcoord);
+	}									// (empty tree: zeros)
+
+	annImagePad(out, pos, hdr.offset[ANN_IMG_NODES]);
+	if (flat != NULL) {					// nodes
+		out.write((const char*) flat->nodes,
+				(streamsize) flat->n_nodes*sizeof(ANNkd_flatNode));
+		pos += (long long) flat->n_nodes*sizeof(ANNkd_flatNode);
+	}
+
+	annImagePad(out, pos, hdr.offset[ANN_IMG_PIDX]);
+	out.write((const char*) pidx, (streamsize) n_pts*sizeof(ANNidx));
+	pos += (long long) n_pts*sizeof(ANNidx);
+
+	annImagePad(out, pos, hdr.offset[ANN_IMG_COORDS]);
+	if (flat != NULL) {					// coordinates in leaf order
+		out.write((const char*) flat->coords,
+				(streamsize) n_pts*dim*sizeof(ANNcoord));
+	}
+	pos += (long long) n_pts*dim*sizeof(ANNcoord);
+
+	annImagePad(out, pos, hdr.offset[ANN_IMG_PTS]);
+	for (int i = 0; i < n_pts; i++) {	// points (need not be contiguous)
+		out.write((const char*) pts[i], dim*sizeof(ANNcoord));
+	}
+
+	if (!out) {
+		annError("Error writing binary image", ANNabort);
+	}
+}
+
+//----------------------------------------------------------------------
+//	Load kd-tree from binary image
+//		This maps the file, checks its header, and points the arrays
+//		of the tree into the mapping, so that nothing is read or
+//		copied except for the header, and the pointers to the points
+//		(pts), which are set up in an array of the image.  The tree is
+//		in the flat layout.  The mapping is read-only, and so is the
+//		tree.  Everything, including the points, belongs to the tree
+//		and is released when it is deleted.
+//----------------------------------------------------------------------
+
+ANNkd_tree::ANNkd_tree(					// load from binary image
+	const char			*file)			// file name
+{
+	ANNimage *img = new ANNimage(file);	// map the file
+
+	ANNimageHeader hdr;					// check the header
+	if (img->size < sizeof(hdr) ||
+		memcmp(img->base, ANN_IMG_MAGIC, sizeof(hdr.magic)) != 0) {
+		annError("Incorrect header for binary image", ANNabort);
+	}
+	memcpy(&hdr, img->base, sizeof(hdr));
+	if (hdr.version != ANN_IMG_VERSION) {
+		annError("Unsupported version of binary image", ANNabort);
+	}
+	if (hdr.byte_order != ANN_IMG_BYTE_ORDER ||
+		hdr.coord_size != (int) sizeof(ANNcoord) ||
+		hdr.idx_size != (int) sizeof(ANNidx) ||
+		hdr.node_size != (int) sizeof(ANNkd_flatNode)) {
+		annError("Binary image was written with different types", ANNabort);
+	}
+	if (hdr.dim < 0 || hdr.n_pts < 0 || hdr.n_nodes < 0 || hdr.depth < 0) {
+		annError("Illegal sizes in binary image", ANNabort);
+	}
+	ANNimageHeader ref;					// what the header should be
+	annImageLayout(ref, hdr.dim, hdr.n_pts, hdr.bkt_size,
+			hdr.n_nodes, hdr.depth);
+	if (memcmp(&hdr, &ref, sizeof(hdr)) != 0 ||
+		ref.size > (long long) img->size) {
+		annError("Binary image is damaged or truncated", ANNabort);
+	}
+
+	char *base = img->base;				// set up the tree
+	SkeletonTree(hdr.n_pts, hdr.dim, hdr.bkt_size, NULL,
+			(ANNidxArray) (base + (size_t) hdr.offset[ANN_IMG_PIDX]));
+	image = img;
+	if (n_pts == 0) return;				// empty tree
+
+	ANNcoord *pc = (ANNcoord*) (base + (size_t) hdr.offset[ANN_IMG_PTS]);
+	img->pts = new ANNpoint[n_pts];		// pointers to the points
+	for (int i = 0; i < n_pts; i++) {
+		img->pts[i] = pc + (size_t) i*dim;
+	}
+	pts = img->pts;
+
+	bnd_box_lo = (ANNpoint) (base + (size_t) hdr.offset[ANN_IMG_BOX]);
+	bnd_box_hi = bnd_box_lo + dim;
+
+	flat = new ANNkd_flat(hdr.n_nodes, hdr.depth,
+			(ANNkd_flatNode*) (base + (size_t) hdr.offset[ANN_IMG_NODES]),
+			pidx,
+			(ANNcoord*) (base + (size_t) hdr.offset[ANN_IMG_COORDS]));
+}
+
+//----------------------------------------------------------------------
+//	ANNimage - mapping of an image file
+//		The whole file is mapped read-only, by mmap() on POSIX systems
+//		and by a file mapping object on Windows.  The file itself is
+//		closed right away, the mapping keeps its contents available.
+//----------------------------------------------------------------------
+
+ANNimage::ANNimage(						// constructor (maps the file)
+	const char			*file)			// file name
+{
+	base = NULL;
+	size = 0;
+	handle = NULL;
+	pts = NULL;
+
+#if defined(_WIN32)
+	HANDLE fh = CreateFileA(file, GENERIC_READ, FILE_SHARE_READ, NULL,
+			OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, NULL);
+	if (fh == INVALID_HANDLE_VALUE) {
+		annError("Cannot open binary image", ANNabort);
+	}
+	LARGE_INTEGER len;
+	if (!GetFileSizeEx(fh, &len)) {
+		annError("Cannot get size of binary image", ANNabort);
+	}
+	size = (size_t) len.QuadPart;
+	if (size > 0) {						// (empty files cannot be mapped)
+		HANDLE mh = CreateFileMappingA(fh, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (mh == NULL) {
+			annError("Cannot map binary image", ANNabort);
+		}
+		base = (char*) MapViewOfFile(mh, FILE_MAP_READ, 0, 0, 0);
+		if (base == NULL) {
+			annError("Cannot map binary image", ANNabort);
+		}
+		handle = mh;
+	}
+	CloseHandle(fh);
+#else
+	int fd = open(file, O_RDONLY);
+	if (fd < 0) {
+		annError("Cannot open binary image", ANNabort);
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		annError("Cannot get size of binary image", ANNabort);
+	}
+	size = (size_t) st.st_size;
+	if (size > 0) {						// (empty files cannot be mapped)
+		void *p = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (p == MAP_FAILED) {
+			annError("Cannot map binary image", ANNabort);
+		}
+		base = (char*) p;
+	}
+	close(fd);
+#endif
+}
+
+ANNimage::~ANNimage()					// destructor (unmaps it)
+{
+	if (pts != NULL) delete [] pts;
+#if defined(_WIN32)
+	if (base != NULL) UnmapViewOfFile(base);
+	if (handle != NULL) CloseHandle((HANDLE) handle);
+#else
+	if (base != NULL) munmap(base, size);
+#endif
+}
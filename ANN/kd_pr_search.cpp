@@ -67,19 +67,11 @@
 //----------------------------------------------------------------------
 
 //----------------------------------------------------------------------
-//		To keep argument lists short, a number of global variables
-//		are maintained which are common to all the recursive calls.
-//		These are given below.
+//		The state which is common to all the recursive calls is kept
+//		in an ANNsearchCtx (see kd_tree.h).  Besides the members used
+//		by the standard search, priority search uses boxPQ.
 //----------------------------------------------------------------------
 
-double			ANNprEps;				// the error bound
-int				ANNprDim;				// dimension of space
-ANNpoint		ANNprQ;					// query point
-double			ANNprMaxErr;			// max tolerable squared error
-ANNpointArray	ANNprPts;				// the points
-ANNpr_queue		*ANNprBoxPQ;			// priority queue for boxes
-ANNmin_k		*ANNprPointMK;			// set of k closest points
-
 //----------------------------------------------------------------------
 //	annkPriSearch - priority search for k nearest neighbors
 //----------------------------------------------------------------------
@@ -91,59 +83,57 @@ void ANNkd_tree::annkPriSearch(
 	ANNdistArray		dd,				// dist to near neighbors (returned)
 	double				eps)			// error bound (ignored)
 {
-										// max tolerable squared error
-	ANNprMaxErr = ANN_POW(1.0 + eps);
+	ANNmin_k pointMK(k);				// create set for closest k points
+	ANNpr_queue boxPQ(n_pts);			// create priority queue for boxes
+	ANNsearchCtx ctx(dim, q, pts, eps, &pointMK);
+	if (max_pts_visit != 0)				// tree has its own limit?
+		ctx.maxPtsVisited = max_pts_visit;
+	ctx.boxPQ = &boxPQ;
 	ANN_FLOP(2)							// increment floating ops
 
-	ANNprDim = dim;						// copy arguments to static equivs
-	ANNprQ = q;
-	ANNprPts = pts;
-	ANNptsVisited = 0;					// initialize count of points visited
-
-	ANNprPointMK = new ANNmin_k(k);		// create set for closest k points
-
 										// distance to root box
 	ANNdist box_dist = annBoxDistance(q,
 				bnd_box_lo, bnd_box_hi, dim);
 
-	ANNprBoxPQ = new ANNpr_queue(n_pts);// create priority queue for boxes
-	ANNprBoxPQ->insert(box_dist, root); // insert root in priority queue
+	if (flat != NULL) {					// flat layout has its own loop
+		flat->ann_pri_search(box_dist, ctx);
+	}
+	else {
+		boxPQ.insert(box_dist, root);	// insert root in priority queue
 
-	while (ANNprBoxPQ->non_empty() &&
-		(!(ANNmaxPtsVisited != 0 && ANNptsVisited > ANNmaxPtsVisited))) {
-		ANNkd_ptr np;					// next box from prior queue
+		while (boxPQ.non_empty() &&
+			(!(ctx.maxPtsVisited != 0 && ctx.ptsVisited > ctx.maxPtsVisited))) {
+			ANNkd_ptr np;				// next box from prior queue
 
 										// extract closest box from queue
-		ANNprBoxPQ->extr_min(box_dist, (void *&) np);
+			boxPQ.extr_min(box_dist, (void *&) np);
 
-		ANN_FLOP(2)						// increment floating ops
-		if (box_dist*ANNprMaxErr >= ANNprPointMK->max_key())
-			break;
+			ANN_FLOP(2)					// increment floating ops
+			if (box_dist*ctx.maxErr >= pointMK.max_key())
+				break;
 
-		np->ann_pri_search(box_dist);	// search this subtree.
+			np->ann_pri_search(box_dist, ctx);// search this subtree.
+		}
 	}
 
 	for (int i = 0; i < k; i++) {		// extract the k-th closest points
-		dd[i] = ANNprPointMK->ith_smallest_key(i);
-		nn_idx[i] = ANNprPointMK->ith_smallest_info(i);
+		dd[i] = pointMK.ith_smallest_key(i);
+		nn_idx[i] = pointMK.ith_smallest_info(i);
 	}
-
-	delete ANNprPointMK;				// deallocate closest point set
-	delete ANNprBoxPQ;					// deallocate priority queue
 }
 
 //----------------------------------------------------------------------
 //	kd_split::ann_pri_search - search a splitting node
 //----------------------------------------------------------------------
 
-void ANNkd_split::ann_pri_search(ANNdist box_dist)
+void ANNkd_split::ann_pri_search(ANNdist box_dist, ANNsearchCtx &ctx)
 {
 	ANNdist new_dist;					// distance to child visited later
 										// distance to cutting plane
-	ANNcoord cut_diff = ANNprQ[cut_dim] - cut_val;
+	ANNcoord cut_diff = ctx.q[cut_dim] - cut_val;
 
 	if (cut_diff < 0) {					// left of cutting plane
-		ANNcoord box_diff = cd_bnds[ANN_LO] - ANNprQ[cut_dim];
+		ANNcoord box_diff = cd_bnds[ANN_LO] - ctx.q[cut_dim];
 		if (box_diff < 0)				// within bounds - ignore
 			box_diff = 0;
 										// distance to further box
@@ -151,12 +141,12 @@ void ANNkd_split::ann_pri_search(ANNdist box_dist)
 				ANN_DIFF(ANN_POW(box_diff), ANN_POW(cut_diff)));
 
 		if (child[ANN_HI] != KD_TRIVIAL)// enqueue if not trivial
-			ANNprBoxPQ->insert(new_dist, child[ANN_HI]);
+			ctx.boxPQ->insert(new_dist, child[ANN_HI]);
 										// continue with closer child
-		child[ANN_LO]->ann_pri_search(box_dist);
+		child[ANN_LO]->ann_pri_search(box_dist, ctx);
 	}
 	else {								// right of cutting plane
-		ANNcoord box_diff = ANNprQ[cut_dim] - cd_bnds[ANN_HI];
+		ANNcoord box_diff = ctx.q[cut_dim] - cd_bnds[ANN_HI];
 		if (box_diff < 0)				// within bounds - ignore
 			box_diff = 0;
 										// distance to further box
@@ -164,11 +154,12 @@ void ANNkd_split::ann_pri_search(ANNdist box_dist)
 				ANN_DIFF(ANN_POW(box_diff), ANN_POW(cut_diff)));
 
 		if (child[ANN_LO] != KD_TRIVIAL)// enqueue if not trivial
-			ANNprBoxPQ->insert(new_dist, child[ANN_LO]);
+			ctx.boxPQ->insert(new_dist, child[ANN_LO]);
 										// continue with closer child
-		child[ANN_HI]->ann_pri_search(box_dist);
+		child[ANN_HI]->ann_pri_search(box_dist, ctx);
 	}
 	ANN_SPL(1)							// one more splitting node visited
+	ctx.splVisited++;					// ...counted in the search state
 	ANN_FLOP(8)							// increment floating ops
 }
 
@@ -178,7 +169,7 @@ void ANNkd_split::ann_pri_search(ANNdist box_dist)
 //		This is virtually identical to the ann_search for standard search.
 //----------------------------------------------------------------------
 
-void ANNkd_leaf::ann_pri_search(ANNdist box_dist)
+void ANNkd_leaf::ann_pri_search(ANNdist box_dist, ANNsearchCtx &ctx)
 {
 	register ANNdist dist;				// distance to data point
 	register ANNcoord* pp;				// data coordinate pointer
@@ -186,16 +177,17 @@ void ANNkd_leaf::ann_pri_search(ANNdist box_dist)
 	register ANNdist min_dist;			// distance to k-th closest point
 	register ANNcoord t;
 	register int d;
+	int hit = 0;						// did we add a point?
 
-	min_dist = ANNprPointMK->max_key(); // k-th smallest distance so far
+	min_dist = ctx.pointMK->max_key(); // k-th smallest distance so far
 
 	for (int i = 0; i < n_pts; i++) {	// check points in bucket
 
-		pp = ANNprPts[bkt[i]];			// first coord of next data point
-		qq = ANNprQ;					// first coord of query point
+		pp = ctx.pts[bkt[i]];			// first coord of next data point
+		qq = ctx.q;					// first coord of query point
 		dist = 0;
 
-		for(d = 0; d < ANNprDim; d++) {
+		for(d = 0; d < ctx.dim; d++) {
 			ANN_COORD(1)				// one more coordinate hit
 			ANN_FLOP(4)					// increment floating ops
 
@@ -206,14 +198,17 @@ void ANNkd_leaf::ann_pri_search(ANNdist box_dist)
 			}
 		}
 
-		if (d >= ANNprDim &&					// among the k best?
+		if (d >= ctx.dim &&					// among the k best?
 		   (ANN_ALLOW_SELF_MATCH || dist!=0)) { // and no self-match problem
 												// add it to the list
-			ANNprPointMK->insert(dist, bkt[i]);
-			min_dist = ANNprPointMK->max_key();
+			ctx.pointMK->insert(dist, bkt[i]);
+			min_dist = ctx.pointMK->max_key();
+			hit = 1;
 		}
 	}
 	ANN_LEAF(1)							// one more leaf node visited
 	ANN_PTS(n_pts)						// increment points visited
-	ANNptsVisited += n_pts;				// increment number of points visited
+	ctx.ptsVisited += n_pts;			// increment number of points visited
+	ctx.lfVisited++;					// ...counted in the search state
+	ctx.lfHits += hit;					// and whether it added a point
 }
@@ -52,8 +52,9 @@
 //		Conference, eds. J. A. Storer and M. Cohn, IEEE Press, 1993,
 //		381-390.
 //
-//		The main entry points is annkSearch() which sets things up and
-//		then call the recursive routine ann_search().  This is a recursive
+//		The main entry points are annkSearch(), ann1Search() and
+//		annkSearchBatch() which set things up and then call the
+//		recursive routine ann_search().  This is a recursive
 //		routine which performs the processing for one node in the kd-tree.
 //		There are two versions of this virtual procedure, one for splitting
 //		nodes and one for leaves.  When a splitting node is visited, we
@@ -71,16 +72,29 @@
 //----------------------------------------------------------------------
 
 //----------------------------------------------------------------------
-//		To keep argument lists short, a number of global variables
-//		are maintained which are common to all the recursive calls.
-//		These are given below.
+//		All the state which is common to the recursive calls is kept
+//		in an ANNsearchCtx (see kd_tree.h), which the entry points set
+//		up on the stack and pass down by reference.
 //----------------------------------------------------------------------
 
-int				ANNkdDim;				// dimension of space
-ANNpoint		ANNkdQ;					// query point
-double			ANNkdMaxErr;			// max tolerable squared error
-ANNpointArray	ANNkdPts;				// the points
-ANNmin_k		*ANNkdPointMK;			// set of k closest points
+//----------------------------------------------------------------------
+//	annAddStats - add the counters of a search to a stats object
+//		A search is counted as stopped early if it has visited more
+//		points than maxPtsVisited, after which it enters no more nodes.
+//----------------------------------------------------------------------
+
+static inline void annAddStats(
+	ANNsearchStats		&st,			// stats (modified)
+	const ANNsearchCtx	&ctx)			// the search
+{
+	st.n_queries++;
+	st.n_spl += ctx.splVisited;
+	st.n_lf += ctx.lfVisited;
+	st.n_pts += ctx.ptsVisited;
+	st.n_lf_hit += ctx.lfHits;
+	if (ctx.maxPtsVisited != 0 && ctx.ptsVisited > ctx.maxPtsVisited)
+		st.n_early++;
+}
 
 //----------------------------------------------------------------------
 //	annkSearch - search for the k nearest neighbors
@@ -93,122 +107,149 @@ void ANNkd_tree::annkSearch(
 	ANNdistArray		dd,				// the approximate nearest neighbor
 	double				eps)			// the error bound
 {
-
-	ANNkdDim = dim;						// copy arguments to static equivs
-	ANNkdQ = q;
-	ANNkdPts = pts;
-	ANNptsVisited = 0;					// initialize count of points visited
-
 	if (k > n_pts) {					// too many near neighbors?
 		annError("Requesting more near neighbors than data points", ANNabort);
 	}
 
-	ANNkdMaxErr = ANN_POW(1.0 + eps);
+	ANNmin_k pointMK(k);				// create set for closest k points
+	ANNsearchCtx ctx(dim, q, pts, eps, &pointMK);
+	if (max_pts_visit != 0)				// tree has its own limit?
+		ctx.maxPtsVisited = max_pts_visit;
 	ANN_FLOP(2)							// increment floating op count
 
-	ANNkdPointMK = new ANNmin_k(k);		// create set for closest k points
 										// search starting at the root
-	root->ann_search(annBoxDistance(q, bnd_box_lo, bnd_box_hi, dim));
+	ANNdist box_dist = annBoxDistance(q, bnd_box_lo, bnd_box_hi, dim);
+	if (flat != NULL)
+		flat->ann_search(box_dist, ctx);
+	else
+		root->ann_search(box_dist, ctx);
 
 	for (int i = 0; i < k; i++) {		// extract the k-th closest points
-		dd[i] = ANNkdPointMK->ith_smallest_key(i);
-		nn_idx[i] = ANNkdPointMK->ith_smallest_info(i);
+		dd[i] = pointMK.ith_smallest_key(i);
+		nn_idx[i] = pointMK.ith_smallest_info(i);
 	}
-	delete ANNkdPointMK;				// deallocate closest point set
 }
 
+//----------------------------------------------------------------------
+//	ann1Search - single nearest neighbor search
+//		The caller supplies the closest point set (which must be empty
+//		on entry, or hold a first candidate such as a guess from an
+//		earlier query), so that it may be reused from one query to the
+//		next, and is told how many points were visited.  If the set
+//		was reset with a bound (see pr_queue_k.h) and the bounding box
+//		is further away than that, the tree is not searched at all.
+//----------------------------------------------------------------------
+
 void ANNkd_tree::ann1Search(
 	ANNpoint		*	q,				// the query point
 	ANNidxArray			nn_idx,			// nearest neighbor indices (returned)
 	ANNdistArray		dd,				// the approximate nearest neighbor
-	double				eps,
-	ANNmin_k		*	mink,
-	int				&	ptsVisited
-	)			// the error bound
+	double				eps,			// the error bound
+	ANNmin_k		*	mink,			// closest point set (caller owned)
+	int				&	ptsVisited,		// number of points visited
+	ANNsearchStats	*	stats)			// search stats (added to)
 {
-	ANNkdDim = dim;						// copy arguments to static equivs
-	//ANNkdQ = q;
-	ANNkdPts = pts;
-	//ANNptsVisited = 0;					// initialize count of points visited
-
 	if (1 > n_pts) {					// too many near neighbors?
 		annError("Requesting more near neighbors than data points", ANNabort);
 	}
 
-	ANNkdMaxErr = ANN_POW(1.0 + eps);
+	ANNsearchCtx ctx(dim, *q, pts, eps, mink);
+	if (max_pts_visit != 0)				// tree has its own limit?
+		ctx.maxPtsVisited = max_pts_visit;
 	ANN_FLOP(2)							// increment floating op count
 
-	//mink = new ANNmin_k();		// create set for closest k points
 										// search starting at the root
-	root->ann_search1(annBoxDistance(*q, bnd_box_lo, bnd_box_hi, dim),mink,ptsVisited,q);
+	ANNdist box_dist = annBoxDistance(*q, bnd_box_lo, bnd_box_hi, dim);
+	if (box_dist * ctx.maxErr < mink->max_key()) {	// within bound?
+		if (flat != NULL)
+			flat->ann_search(box_dist, ctx);
+		else
+			root->ann_search(box_dist, ctx);
+	}
 
-	// extract the closest points
-	dd[0] = mink->ith_smallest_key(0);
+	dd[0] = mink->ith_smallest_key(0);	// extract the closest point
 	nn_idx[0] = mink->ith_smallest_info(0);
-	
-	//delete mink;				// deallocate closest point set
+	ptsVisited += ctx.ptsVisited;
+	if (stats != NULL) annAddStats(*stats, ctx);
 }
 
-
-
 //----------------------------------------------------------------------
-//	kd_split::ann_search - search a splitting node
+//	annkSearchBatch - search for the k nearest neighbors of many points
+//		The results of query i are in nn_idx[i*k..i*k+k-1] and
+//		dd[i*k..i*k+k-1].  With OpenMP the queries are split among
+//		a team of threads (the searches are re-entrant).  Each thread
+//		sets up one set of closest points and reuses it for all its
+//		queries, and counts its stats apart from the others.
 //----------------------------------------------------------------------
 
-void ANNkd_split::ann_search(ANNdist box_dist)
+void ANNkd_tree::annkSearchBatch(
+	ANNpointArray		q,				// the query points
+	int					m,				// number of query points
+	int					k,				// number of near neighbors per query
+	ANNidxArray			nn_idx,			// nearest neighbor indices (returned)
+	ANNdistArray		dd,				// the approximate nearest neighbors
+	double				eps,			// the error bound
+	ANNsearchStats		*stats)			// search stats (added to)
 {
-										// check dist calc term condition
-	if (ANNmaxPtsVisited != 0 && ANNptsVisited > ANNmaxPtsVisited) return;
-
-										// distance to cutting plane
-	ANNcoord cut_diff = ANNkdQ[cut_dim] - cut_val;
-
-	if (cut_diff < 0) {					// left of cutting plane
-		child[ANN_LO]->ann_search(box_dist);// visit closer child first
-
-		ANNcoord box_diff = cd_bnds[ANN_LO] - ANNkdQ[cut_dim];
-		if (box_diff < 0)				// within bounds - ignore
-			box_diff = 0;
-										// distance to further box
-		box_dist = (ANNdist) ANN_SUM(box_dist,
-				ANN_DIFF(ANN_POW(box_diff), ANN_POW(cut_diff)));
-
-										// visit further child if close enough
-		if (box_dist * ANNkdMaxErr < ANNkdPointMK->max_key())
-			child[ANN_HI]->ann_search(box_dist);
-
+	if (k > n_pts) {					// too many near neighbors?
+		annError("Requesting more near neighbors than data points", ANNabort);
 	}
-	else {								// right of cutting plane
-		child[ANN_HI]->ann_search(box_dist);// visit closer child first
 
-		ANNcoord box_diff = ANNkdQ[cut_dim] - cd_bnds[ANN_HI];
-		if (box_diff < 0)				// within bounds - ignore
-			box_diff = 0;
-										// distance to further box
-		box_dist = (ANNdist) ANN_SUM(box_dist,
-				ANN_DIFF(ANN_POW(box_diff), ANN_POW(cut_diff)));
-
-										// visit further child if close enough
-		if (box_dist * ANNkdMaxErr < ANNkdPointMK->max_key())
-			child[ANN_LO]->ann_search(box_dist);
+#ifdef _OPENMP
+#pragma omp parallel if (m > 256)
+#endif
+	{
+		ANNmin_k pointMK(k);			// closest k points of a query
+		ANNsearchStats st;				// stats of this thread
+
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic, 256)
+#endif
+		for (int j = 0; j < m; j++) {
+			pointMK.reset();
+			ANNsearchCtx ctx(dim, q[j], pts, eps, &pointMK);
+			if (max_pts_visit != 0)		// tree has its own limit?
+				ctx.maxPtsVisited = max_pts_visit;
+			ANN_FLOP(2)					// increment floating op count
 
+										// search starting at the root
+			ANNdist box_dist = annBoxDistance(q[j], bnd_box_lo, bnd_box_hi, dim);
+			if (flat != NULL)
+				flat->ann_search(box_dist, ctx);
+			else
+				root->ann_search(box_dist, ctx);
+
+			for (int i = 0; i < k; i++) {	// extract the k-th closest points
+				dd[j*k + i] = pointMK.ith_smallest_key(i);
+				nn_idx[j*k + i] = pointMK.ith_smallest_info(i);
+			}
+			if (stats != NULL) annAddStats(st, ctx);
+		}
+		if (stats != NULL) {			// add them up
+#ifdef _OPENMP
+#pragma omp critical (ANNsearchStats)
+#endif
+			stats->merge(st);
+		}
 	}
-	ANN_FLOP(10)						// increment floating ops
-	ANN_SPL(1)							// one more splitting node visited
 }
 
-void ANNkd_split::ann_search1(ANNdist box_dist,ANNmin_k		*	mink,int				&	ptsVisited,ANNpoint * kqd)
+//----------------------------------------------------------------------
+//	kd_split::ann_search - search a splitting node
+//----------------------------------------------------------------------
+
+void ANNkd_split::ann_search(ANNdist box_dist, ANNsearchCtx &ctx)
 {
 										// check dist calc term condition
-	if (ANNmaxPtsVisited != 0 && ptsVisited > ANNmaxPtsVisited) return;
+	if (ctx.maxPtsVisited != 0 && ctx.ptsVisited > ctx.maxPtsVisited) return;
 
 										// distance to cutting plane
-	ANNcoord cut_diff = (*kqd)[cut_dim] - cut_val;
+	ANNcoord cut_diff = ctx.q[cut_dim] - cut_val;
 
 	if (cut_diff < 0) {					// left of cutting plane
-		child[ANN_LO]->ann_search1(box_dist,mink,ptsVisited,kqd);// visit closer child first
+		child[ANN_LO]->ann_search(box_dist, ctx);// visit closer child first
 
-		ANNcoord box_diff = cd_bnds[ANN_LO] - (*kqd)[cut_dim];
+		ANNcoord box_diff = cd_bnds[ANN_LO] - ctx.q[cut_dim];
 		if (box_diff < 0)				// within bounds - ignore
 			box_diff = 0;
 										// distance to further box
@@ -216,14 +257,14 @@ void ANNkd_split::ann_search1(ANNdist box_dist,ANNmin_k		*	mink,int				&	ptsVisi
 				ANN_DIFF(ANN_POW(box_diff), ANN_POW(cut_diff)));
 
 										// visit further child if close enough
-		if (box_dist * ANNkdMaxErr < mink->max_key())
-			child[ANN_HI]->ann_search1(box_dist,mink,ptsVisited,kqd);
+		if (box_dist * ctx.maxErr < ctx.pointMK->max_key())
+			child[ANN_HI]->ann_search(box_dist, ctx);
 
 	}
 	else {								// right of cutting plane
-		child[ANN_HI]->ann_search1(box_dist,mink,ptsVisited,kqd);// visit closer child first
+		child[ANN_HI]->ann_search(box_dist, ctx);// visit closer child first
 
-		ANNcoord box_diff = (*kqd)[cut_dim] - cd_bnds[ANN_HI];
+		ANNcoord box_diff = ctx.q[cut_dim] - cd_bnds[ANN_HI];
 		if (box_diff < 0)				// within bounds - ignore
 			box_diff = 0;
 										// distance to further box
@@ -231,22 +272,29 @@ void ANNkd_split::ann_search1(ANNdist box_dist,ANNmin_k		*	mink,int				&	ptsVisi
 				ANN_DIFF(ANN_POW(box_diff), ANN_POW(cut_diff)));
 
 										// visit further child if close enough
-		if (box_dist * ANNkdMaxErr < mink->max_key())
-			child[ANN_LO]->ann_search1(box_dist,mink,ptsVisited,kqd);
+		if (box_dist * ctx.maxErr < ctx.pointMK->max_key())
+			child[ANN_LO]->ann_search(box_dist, ctx);
 
 	}
 	ANN_FLOP(10)						// increment floating ops
 	ANN_SPL(1)							// one more splitting node visited
+	ctx.splVisited++;					// ...counted in the search state
 }
 
-
 //----------------------------------------------------------------------
 //	kd_leaf::ann_search - search points in a leaf node
 //		Note: The unreadability of this code is the result of
 //		some fine tuning to replace indexing by pointer operations.
+//
+//		For k = 1 (ONE) the closest point of the bucket is kept in
+//		registers and only that one is inserted, at the end.
 //----------------------------------------------------------------------
 
-void ANNkd_leaf::ann_search(ANNdist box_dist)
+template <bool ONE>
+inline void annLeafSearch(
+	int					n_pts,			// no. points in bucket
+	ANNidxArray			bkt,			// bucket of points
+	ANNsearchCtx		&ctx)			// search state
 {
 	register ANNdist dist;				// distance to data point
 	register ANNcoord* pp;				// data coordinate pointer
@@ -254,16 +302,18 @@ void ANNkd_leaf::ann_search(ANNdist box_dist)
 	register ANNdist min_dist;			// distance to k-th closest point
 	register ANNcoord t;
 	register int d;
+	int best = -1;						// closest in bucket (if ONE)
+	int hit = 0;						// did we add a point?
 
-	min_dist = ANNkdPointMK->max_key(); // k-th smallest distance so far
+	min_dist = ctx.pointMK->max_key();	// k-th smallest distance so far
 
 	for (int i = 0; i < n_pts; i++) {	// check points in bucket
 
-		pp = ANNkdPts[bkt[i]];			// first coord of next data point
-		qq = ANNkdQ;					// first coord of query point
+		pp = ctx.pts[bkt[i]];			// first coord of next data point
+		qq = ctx.q;						// first coord of query point
 		dist = 0;
 
-		for(d = 0; d < ANNkdDim; d++) {
+		for(d = 0; d < ctx.dim; d++) {
 			ANN_COORD(1)				// one more coordinate hit
 			ANN_FLOP(4)					// increment floating ops
 
@@ -274,56 +324,37 @@ void ANNkd_leaf::ann_search(ANNdist box_dist)
 			}
 		}
 
-		if (d >= ANNkdDim &&					// among the k best?
+		if (d >= ctx.dim &&						// among the k best?
 		   (ANN_ALLOW_SELF_MATCH || dist!=0)) { // and no self-match problem
-												// add it to the list
-			ANNkdPointMK->insert(dist, bkt[i]);
-			min_dist = ANNkdPointMK->max_key();
+			if (ONE) {							// closest so far
+				if (best < 0 || dist < min_dist) {
+					best = i;
+					min_dist = dist;
+				}
+			}
+			else {								// add it to the list
+				ctx.pointMK->insert(dist, bkt[i]);
+				min_dist = ctx.pointMK->max_key();
+				hit = 1;
+			}
 		}
 	}
+	if (ONE && best >= 0) {				// add the closest one
+		ctx.pointMK->insert(min_dist, bkt[best]);
+		hit = 1;
+	}
+
 	ANN_LEAF(1)							// one more leaf node visited
 	ANN_PTS(n_pts)						// increment points visited
-	ANNptsVisited += n_pts;				// increment number of points visited
+	ctx.ptsVisited += n_pts;			// increment number of points visited
+	ctx.lfVisited++;					// ...counted in the search state
+	ctx.lfHits += hit;					// and whether it added a point
 }
 
-
-void ANNkd_leaf::ann_search1(ANNdist box_dist,ANNmin_k		*	mink,int				&	ptsVisited,ANNpoint * kqd)
+void ANNkd_leaf::ann_search(ANNdist box_dist, ANNsearchCtx &ctx)
 {
-	register ANNdist dist;				// distance to data point
-	register ANNcoord* pp;				// data coordinate pointer
-	register ANNcoord* qq;				// query coordinate pointer
-	register ANNdist min_dist;			// distance to k-th closest point
-	register ANNcoord t;
-	register int d;
-
-	min_dist = mink->max_key(); // k-th smallest distance so far
-
-	for (int i = 0; i < n_pts; i++) {	// check points in bucket
-
-		pp = ANNkdPts[bkt[i]];			// first coord of next data point
-		qq = (*kqd);					// first coord of query point
-		dist = 0;
-
-		for(d = 0; d < ANNkdDim; d++) {
-			ANN_COORD(1)				// one more coordinate hit
-			ANN_FLOP(4)					// increment floating ops
-
-			t = *(qq++) - *(pp++);		// compute length and adv coordinate
-										// exceeds dist to k-th smallest?
-			if( (dist = ANN_SUM(dist, ANN_POW(t))) > min_dist) {
-				break;
-			}
-		}
-
-		if (d >= ANNkdDim &&					// among the k best?
-		   (ANN_ALLOW_SELF_MATCH || dist!=0)) { // and no self-match problem
-												// add it to the list
-			mink->insert(dist, bkt[i]);
-			min_dist = mink->max_key();
-		}
-	}
-	ANN_LEAF(1)							// one more leaf node visited
-	ANN_PTS(n_pts)						// increment points visited
-	ptsVisited += n_pts;				// increment number of points visited
-
+	if (ctx.pointMK->max_k() == 1)
+		annLeafSearch<true>(n_pts, bkt, ctx);
+	else
+		annLeafSearch<false>(n_pts, bkt, ctx);
 }
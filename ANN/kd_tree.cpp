@@ -29,8 +29,10 @@
 //----------------------------------------------------------------------
 
 #include "kd_tree.h"					// kd-tree declarations
+#include "kd_flat.h"					// flat kd-tree declarations
 #include "kd_split.h"					// kd-tree splitting rules
 #include "kd_util.h"					// kd-tree utilities
+#include <new>							// placement new
 #include <ANN/ANNperf.h>				// performance evaluation
 
 //----------------------------------------------------------------------
@@ -114,7 +116,9 @@ void ANNkd_tree::Print(					// print entire tree
 			out << "\n";
 		}
 	}
-	if (root == NULL)					// empty tree?
+	if (flat != NULL)					// flat layout?
+		flat->print(out);
+	else if (root == NULL)				// empty tree?
 		out << "    Null tree.\n";
 	else {
 		root->print(0, out);			// invoke printing at root
@@ -194,7 +198,11 @@ void ANNkd_tree::getStats(						// get tree statistics
 	st.reset(dim, n_pts, bkt_size);				// reset stats
 												// create bounding box
 	ANNorthRect bnd_box(dim, bnd_box_lo, bnd_box_hi);
-	if (root != NULL) {							// if nonempty tree
+	if (flat != NULL) {							// if flat tree
+		flat->getStats(dim, st, bnd_box);		// get statistics
+		st.avg_ar = st.sum_ar / st.n_lf;		// average leaf asp ratio
+	}
+	else if (root != NULL) {					// if nonempty tree
 		root->getStats(dim, st, bnd_box);		// get statistics
 		st.avg_ar = st.sum_ar / st.n_lf;		// average leaf asp ratio
 	}
@@ -203,15 +211,23 @@ void ANNkd_tree::getStats(						// get tree statistics
 //----------------------------------------------------------------------
 //	kd_tree destructor
 //		The destructor just frees the various elements that were
-//		allocated in the construction process.
+//		allocated in the construction process.  Nodes in an arena
+//		are freed with it, other nodes delete their children.  A tree
+//		loaded from a binary image has its arrays (and its points) in
+//		the image, and they all go when it is unmapped.
 //----------------------------------------------------------------------
 
 ANNkd_tree::~ANNkd_tree()				// tree destructor
 {
-	if (root != NULL) delete root;
-	if (pidx != NULL) delete [] pidx;
-	if (bnd_box_lo != NULL) annDeallocPt(bnd_box_lo);
-	if (bnd_box_hi != NULL) annDeallocPt(bnd_box_hi);
+	if (arena != NULL) delete arena;
+	else if (root != NULL) delete root;
+	if (flat != NULL) delete flat;
+	if (image != NULL) delete image;	// the rest is in the image
+	else {
+		if (pidx != NULL) delete [] pidx;
+		if (bnd_box_lo != NULL) annDeallocPt(bnd_box_lo);
+		if (bnd_box_hi != NULL) annDeallocPt(bnd_box_hi);
+	}
 }
 
 //----------------------------------------------------------------------
@@ -254,6 +270,10 @@ void ANNkd_tree::SkeletonTree(			// construct skeleton tree
 	pts = pa;							// initialize points array
 
 	root = NULL;						// no associated tree yet
+	flat = NULL;
+	arena = NULL;
+	image = NULL;
+	max_pts_visit = 0;					// use global limit
 
 	if (pi == NULL) {					// point indices provided?
 		pidx = new ANNidx[n];			// no, allocate space for point indices
@@ -293,6 +313,9 @@ ANNkd_tree::ANNkd_tree(					// basic constructor
 //		the points.  When the number of points falls below the bucket size,
 //		we simply store the points in a leaf node's bucket.
 //
+//		The nodes are allocated from the arena of the tree (see
+//		kd_util.h), which may be used by several threads at once.
+//
 //		One of the arguments is a pointer to a splitting routine,
 //		whose prototype is:
 //		
@@ -318,13 +341,14 @@ ANNkd_ptr rkd_tree(				// recursive construction of kd-tree
 	int					dim,			// dimension of space
 	int					bsp,			// bucket space
 	ANNorthRect			&bnd_box,		// bounding box for current node
-	ANNkd_splitter		splitter)		// splitting routine
+	ANNkd_splitter		splitter,		// splitting routine
+	ANNarena			*arena)			// storage for the nodes
 {
 	if (n <= bsp) {						// n small, make a leaf node
 		if (n == 0)						// empty leaf node
 			return KD_TRIVIAL;			// return (canonical) empty leaf
 		else							// construct the node and return
-			return new ANNkd_leaf(n, pidx); 
+			return new (arena->alloc(sizeof(ANNkd_leaf))) ANNkd_leaf(n, pidx);
 	}
 	else {								// n large, make a splitting node
 		int cd;							// cutting dimension
@@ -338,20 +362,38 @@ ANNkd_ptr rkd_tree(				// recursive construction of kd-tree
 		ANNcoord lv = bnd_box.lo[cd];	// save bounds for cutting dimension
 		ANNcoord hv = bnd_box.hi[cd];
 
-		bnd_box.hi[cd] = cv;			// modify bounds for left subtree
-		lo = rkd_tree(					// build left subtree
-				pa, pidx, n_lo,			// ...from pidx[0..n_lo-1]
-				dim, bsp, bnd_box, splitter);
-		bnd_box.hi[cd] = hv;			// restore bounds
-
-		bnd_box.lo[cd] = cv;			// modify bounds for right subtree
-		hi = rkd_tree(					// build right subtree
-				pa, pidx + n_lo, n-n_lo,// ...from pidx[n_lo..n-1]
-				dim, bsp, bnd_box, splitter);
-		bnd_box.lo[cd] = lv;			// restore bounds
+#ifdef ANN_OMP_TASKS
+		if (n_lo >= ANN_PAR_BUILD && n-n_lo >= ANN_PAR_BUILD) {
+										// build left subtree as a task
+			ANNorthRect lo_box(dim, bnd_box);	// ...with its own box
+			lo_box.hi[cd] = cv;
+#pragma omp task shared(lo, lo_box)
+			lo = rkd_tree(pa, pidx, n_lo, dim, bsp, lo_box, splitter, arena);
+
+			bnd_box.lo[cd] = cv;		// build right subtree meanwhile
+			hi = rkd_tree(pa, pidx + n_lo, n-n_lo, dim, bsp, bnd_box, splitter, arena);
+			bnd_box.lo[cd] = lv;		// restore bounds
+#pragma omp taskwait
+		}
+		else
+#endif
+		{
+			bnd_box.hi[cd] = cv;		// modify bounds for left subtree
+			lo = rkd_tree(				// build left subtree
+					pa, pidx, n_lo,		// ...from pidx[0..n_lo-1]
+					dim, bsp, bnd_box, splitter, arena);
+			bnd_box.hi[cd] = hv;		// restore bounds
+
+			bnd_box.lo[cd] = cv;		// modify bounds for right subtree
+			hi = rkd_tree(				// build right subtree
+					pa, pidx + n_lo, n-n_lo,// ...from pidx[n_lo..n-1]
+					dim, bsp, bnd_box, splitter, arena);
+			bnd_box.lo[cd] = lv;		// restore bounds
+		}
 
 										// create the splitting node
-		ANNkd_split *ptr = new ANNkd_split(cd, cv, lv, hv, lo, hi);
+		ANNkd_split *ptr = new (arena->alloc(sizeof(ANNkd_split)))
+								ANNkd_split(cd, cv, lv, hv, lo, hi);
 
 		return ptr;						// return pointer to this node
 	}
@@ -363,6 +405,11 @@ ANNkd_ptr rkd_tree(				// recursive construction of kd-tree
 //		It first builds a skeleton tree, then computes the bounding box
 //		of the data points, and then invokes rkd_tree() to actually
 //		build the tree, passing it the appropriate splitting routine.
+//		In the flat layout the tree is built by the ANNkd_flat
+//		constructor instead, and root is left NULL.  Large trees are
+//		built by a team of threads (see kd_util.h); the parallel
+//		region is opened here, and the tasks are created by the
+//		building routines.
 //----------------------------------------------------------------------
 
 ANNkd_tree::ANNkd_tree(					// construct from point array
@@ -370,36 +417,54 @@ ANNkd_tree::ANNkd_tree(					// construct from point array
 	int					n,				// number of points
 	int					dd,				// dimension
 	int					bs,				// bucket size
-	ANNsplitRule		split)			// splitting method
+	ANNsplitRule		split,			// splitting method
+	ANNlayout			layout)			// layout of nodes
 {
 	SkeletonTree(n, dd, bs);			// set up the basic stuff
 	pts = pa;							// where the points are
 	if (n == 0) return;					// no points--no sweat
 
-	ANNorthRect bnd_box(dd);			// bounding box for points
-	annEnclRect(pa, pidx, n, dd, bnd_box);// construct bounding rectangle
-										// copy to tree structure
-	bnd_box_lo = annCopyPt(dd, bnd_box.lo);
-	bnd_box_hi = annCopyPt(dd, bnd_box.hi);
-
-	switch (split) {					// build by rule
+	ANNkd_splitter splitter = NULL;		// splitting routine
+	switch (split) {					// select by rule
 	case ANN_KD_STD:					// standard kd-splitting rule
-		root = rkd_tree(pa, pidx, n, dd, bs, bnd_box, kd_split);
+		splitter = kd_split;
 		break;
 	case ANN_KD_MIDPT:					// midpoint split
-		root = rkd_tree(pa, pidx, n, dd, bs, bnd_box, midpt_split);
+		splitter = midpt_split;
 		break;
 	case ANN_KD_FAIR:					// fair split
-		root = rkd_tree(pa, pidx, n, dd, bs, bnd_box, fair_split);
+		splitter = fair_split;
 		break;
 	case ANN_KD_SUGGEST:				// best (in our opinion)
 	case ANN_KD_SL_MIDPT:				// sliding midpoint split
-		root = rkd_tree(pa, pidx, n, dd, bs, bnd_box, sl_midpt_split);
+		splitter = sl_midpt_split;
 		break;
 	case ANN_KD_SL_FAIR:				// sliding fair split
-		root = rkd_tree(pa, pidx, n, dd, bs, bnd_box, sl_fair_split);
+		splitter = sl_fair_split;
 		break;
 	default:
 		annError("Illegal splitting method", ANNabort);
 	}
+
+	ANNorthRect bnd_box(dd);			// bounding box for points
+
+	if (layout != ANN_LAYOUT_FLAT)		// storage for about 2n/bs nodes
+		arena = new ANNarena((2*(n/(bs > 0 ? bs : 1)) + 1) * sizeof(ANNkd_split));
+
+										// large trees are built by a team
+#ifdef ANN_OMP_TASKS
+#pragma omp parallel if (n >= ANN_PAR_BUILD)
+#pragma omp single
+#endif
+	{
+		annEnclRect(pa, pidx, n, dd, bnd_box);// construct bounding rectangle
+										// copy to tree structure
+		bnd_box_lo = annCopyPt(dd, bnd_box.lo);
+		bnd_box_hi = annCopyPt(dd, bnd_box.hi);
+
+		if (layout == ANN_LAYOUT_FLAT)	// build by layout
+			flat = new ANNkd_flat(pa, pidx, n, dd, bs, bnd_box, splitter);
+		else
+			root = rkd_tree(pa, pidx, n, dd, bs, bnd_box, splitter, arena);
+	}
 }
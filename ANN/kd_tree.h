@@ -31,6 +31,69 @@
 
 using namespace std;					// make std:: available
 
+//----------------------------------------------------------------------
+//	Search context
+//		An ANNsearchCtx holds everything a single search needs while it
+//		descends the tree: the query point, the constants of the tree
+//		being searched, the set of closest points found so far and the
+//		visit counters.  The counters are plain members, which the
+//		entry points add to an ANNsearchStats if they are given one
+//		(see ANNperf.h).  The entry points (annkSearch(), ann1Search(),
+//		annkPriSearch() and annkFRSearch()) each set one up on the stack
+//		and pass it by reference through the recursion, so that nothing
+//		is shared between searches and one tree may be searched by
+//		several threads at once.
+//
+//		The members after maxErr are only used by some of the searches:
+//		sqRad and ptsInRange by fixed-radius search, and boxPQ by
+//		priority search.
+//
+//		maxPtsVisited is the global limit set by annMaxPtsVisit(),
+//		unless the tree has a limit of its own (see setMaxPtsVisit()),
+//		which the entry points then put in its place.
+//----------------------------------------------------------------------
+
+class ANNpr_queue;						// priority queue (pr_queue.h)
+
+class ANNsearchCtx {					// state of one search
+public:
+	int				dim;				// dimension of space
+	ANNpoint		q;					// query point
+	ANNpointArray	pts;				// the points
+	double			maxErr;				// max tolerable squared error
+	ANNmin_k		*pointMK;			// set of k closest points
+	int				ptsVisited;			// number of points visited
+	int				maxPtsVisited;		// limit on ptsVisited (0 = none)
+	int				splVisited;			// splitting nodes visited
+	int				lfVisited;			// leaves visited
+	int				lfHits;				// leaves which added a point
+	ANNdist			sqRad;				// squared radius search bound
+	int				ptsInRange;			// number of points in the range
+	ANNpr_queue		*boxPQ;				// priority queue for boxes
+
+	ANNsearchCtx(						// constructor
+		int				dd,				// dimension of space
+		ANNpoint		qq,				// query point
+		ANNpointArray	pa,				// the points
+		double			eps,			// the error bound
+		ANNmin_k		*mk)			// set of k closest points
+		{
+			dim			= dd;
+			q			= qq;
+			pts			= pa;
+			maxErr		= ANN_POW(1.0 + eps);
+			pointMK		= mk;
+			ptsVisited	= 0;
+			maxPtsVisited = ANNmaxPtsVisited;
+			splVisited	= 0;
+			lfVisited	= 0;
+			lfHits		= 0;
+			sqRad		= ANN_DIST_INF;
+			ptsInRange	= 0;
+			boxPQ		= NULL;
+		}
+};
+
 //----------------------------------------------------------------------
 //	Generic kd-tree node
 //
@@ -47,10 +110,9 @@ class ANNkd_node{						// generic kd-tree node (empty shell)
 public:
 	virtual ~ANNkd_node() {}					// virtual distroyer
 
-	virtual void ann_search(ANNdist) = 0;		// tree search
-	virtual void ann_search1(ANNdist box_dist,ANNmin_k	*	mink,int				&	ptsVisited,ANNpoint * kqd) = 0;		// tree search
-	virtual void ann_pri_search(ANNdist) = 0;	// priority search
-	virtual void ann_FR_search(ANNdist) = 0;	// fixed-radius search
+	virtual void ann_search(ANNdist, ANNsearchCtx&) = 0;	// tree search
+	virtual void ann_pri_search(ANNdist, ANNsearchCtx&) = 0;// priority search
+	virtual void ann_FR_search(ANNdist, ANNsearchCtx&) = 0;	// fixed-radius search
 
 	virtual void getStats(						// get tree statistics
 				int dim,						// dimension of space
@@ -111,10 +173,9 @@ public:
 	virtual void print(int level, ostream &out);// print node
 	virtual void dump(ostream &out);			// dump node
 
-	virtual void ann_search(ANNdist);			// standard search
-	virtual void ann_search1(ANNdist box_dist,ANNmin_k		*	mink,int				&	ptsVisited,ANNpoint * kqd);
-	virtual void ann_pri_search(ANNdist);		// priority search
-	virtual void ann_FR_search(ANNdist);		// fixed-radius search
+	virtual void ann_search(ANNdist, ANNsearchCtx&);	// standard search
+	virtual void ann_pri_search(ANNdist, ANNsearchCtx&);// priority search
+	virtual void ann_FR_search(ANNdist, ANNsearchCtx&);	// fixed-radius search
 };
 
 //----------------------------------------------------------------------
@@ -178,10 +239,9 @@ public:
 	virtual void print(int level, ostream &out);// print node
 	virtual void dump(ostream &out);			// dump node
 
-	virtual void ann_search(ANNdist);			// standard search
-	virtual void ann_search1(ANNdist box_dist,ANNmin_k		*	mink,int				&	ptsVisited,ANNpoint * kqd);
-	virtual void ann_pri_search(ANNdist);		// priority search
-	virtual void ann_FR_search(ANNdist);		// fixed-radius search
+	virtual void ann_search(ANNdist, ANNsearchCtx&);	// standard search
+	virtual void ann_pri_search(ANNdist, ANNsearchCtx&);// priority search
+	virtual void ann_FR_search(ANNdist, ANNsearchCtx&);	// fixed-radius search
 };
 
 //----------------------------------------------------------------------
@@ -195,6 +255,7 @@ ANNkd_ptr rkd_tree(				// recursive construction of kd-tree
 	int					dim,			// dimension of space
 	int					bsp,			// bucket space
 	ANNorthRect			&bnd_box,		// bounding box for current node
-	ANNkd_splitter		splitter);		// splitting routine
+	ANNkd_splitter		splitter,		// splitting routine
+	ANNarena			*arena);		// storage for the nodes
 
 #endif
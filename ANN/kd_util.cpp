@@ -24,6 +24,7 @@
 
 #include "kd_util.h"					// kd-utility declarations
 
+#include <new>							// placement new
 #include <ANN/ANNperf.h>				// performance evaluation
 
 //----------------------------------------------------------------------
@@ -78,14 +79,7 @@ void annEnclRect(
 	ANNorthRect			&bnds)			// bounding cube (returned)
 {
 	for (int d = 0; d < dim; d++) {		// find smallest enclosing rectangle
-		ANNcoord lo_bnd = PA(0,d);		// lower bound on dimension d
-		ANNcoord hi_bnd = PA(0,d);		// upper bound on dimension d
-		for (int i = 0; i < n; i++) {
-			if (PA(i,d) < lo_bnd) lo_bnd = PA(i,d);
-			else if (PA(i,d) > hi_bnd) hi_bnd = PA(i,d);
-		}
-		bnds.lo[d] = lo_bnd;
-		bnds.hi[d] = hi_bnd;
+		annMinMax(pa, pidx, n, d, bnds.lo[d], bnds.hi[d]);
 	}
 }
 
@@ -149,21 +143,38 @@ ANNdist annBoxDistance(			// compute distance from point to box
 //	annSpread - find spread along given dimension
 //	annMinMax - find min and max coordinates along given dimension
 //	annMaxSpread - find dimension of max spread
+//
+//		When called by a thread of a team building a tree in parallel
+//		(see kd_util.h), annMinMax splits large point sets into one
+//		piece per thread, scans each as a task and combines the
+//		results.  The others are built on annMinMax.
 //----------------------------------------------------------------------
 
-ANNcoord annSpread(				// compute point spread along dimension
+static void annMinMaxScan(		// serial scan for min and max
 	ANNpointArray		pa,				// point array
 	ANNidxArray			pidx,			// point indices
 	int					n,				// number of points
-	int					d)				// dimension to check
+	int					d,				// dimension to check
+	ANNcoord			&min,			// minimum value (returned)
+	ANNcoord			&max)			// maximum value (returned)
 {
-	ANNcoord min = PA(0,d);				// compute max and min coords
-	ANNcoord max = PA(0,d);
+	min = PA(0,d);						// compute max and min coords
+	max = PA(0,d);
 	for (int i = 1; i < n; i++) {
 		ANNcoord c = PA(i,d);
 		if (c < min) min = c;
 		else if (c > max) max = c;
 	}
+}
+
+ANNcoord annSpread(				// compute point spread along dimension
+	ANNpointArray		pa,				// point array
+	ANNidxArray			pidx,			// point indices
+	int					n,				// number of points
+	int					d)				// dimension to check
+{
+	ANNcoord min, max;					// compute max and min coords
+	annMinMax(pa, pidx, n, d, min, max);
 	return (max - min);					// total spread is difference
 }
 
@@ -175,13 +186,32 @@ void annMinMax(					// compute min and max coordinates along dim
 	ANNcoord			&min,			// minimum value (returned)
 	ANNcoord			&max)			// maximum value (returned)
 {
-	min = PA(0,d);						// compute max and min coords
-	max = PA(0,d);
-	for (int i = 1; i < n; i++) {
-		ANNcoord c = PA(i,d);
-		if (c < min) min = c;
-		else if (c > max) max = c;
+#ifdef ANN_OMP_TASKS
+	const int MAX_PIECES = 64;			// most pieces we split into
+	int n_pc = omp_get_num_threads();	// one piece per thread
+	if (n_pc > MAX_PIECES) n_pc = MAX_PIECES;
+
+	if (n >= ANN_PAR_BUILD && n_pc > 1) {
+		ANNcoord pc_min[MAX_PIECES];	// results for the pieces
+		ANNcoord pc_max[MAX_PIECES];
+		for (int p = 0; p < n_pc; p++) {
+			int lo = (int) ((long long) n*p/n_pc);	// piece is [lo..hi-1]
+			int hi = (int) ((long long) n*(p+1)/n_pc);
+#pragma omp task shared(pc_min, pc_max) firstprivate(p, lo, hi)
+			annMinMaxScan(pa, pidx + lo, hi - lo, d, pc_min[p], pc_max[p]);
+		}
+#pragma omp taskwait
+
+		min = pc_min[0];				// combine them
+		max = pc_max[0];
+		for (int p = 1; p < n_pc; p++) {
+			if (pc_min[p] < min) min = pc_min[p];
+			if (pc_max[p] > max) max = pc_max[p];
+		}
+		return;
 	}
+#endif
+	annMinMaxScan(pa, pidx, n, d, min, max);
 }
 
 int annMaxSpread(						// compute dimension of max spread
@@ -377,8 +407,9 @@ int annSplitBalance(			// determine balance factor of a split
 //		box, this routine determines all the sides for which the
 //		inner box is strictly contained with the bounding box,
 //		and adds an appropriate entry to a list of bounds.  Then
-//		we allocate storage for the final list of bounds, and return
-//		the resulting list and its size.
+//		we allocate storage for the final list of bounds (from the
+//		arena if one is given), and return the resulting list and
+//		its size.
 //----------------------------------------------------------------------
 
 void annBox2Bnds(						// convert inner box to bounds
@@ -386,7 +417,8 @@ void annBox2Bnds(						// convert inner box to bounds
 	const ANNorthRect	&bnd_box,		// enclosing box
 	int					dim,			// dimension of space
 	int					&n_bnds,		// number of bounds (returned)
-	ANNorthHSArray		&bnds)			// bounds array (returned)
+	ANNorthHSArray		&bnds,			// bounds array (returned)
+	ANNarena			*arena)			// storage for bounds (or heap)
 {
 	int i;
 	n_bnds = 0;									// count number of bounds
@@ -397,7 +429,12 @@ void annBox2Bnds(						// convert inner box to bounds
 				n_bnds++;
 	}
 
-	bnds = new ANNorthHalfSpace[n_bnds];		// allocate appropriate size
+	if (arena == NULL)							// allocate appropriate size
+		bnds = new ANNorthHalfSpace[n_bnds];
+	else {										// ...from the arena
+		bnds = (ANNorthHSArray) arena->alloc(n_bnds*sizeof(ANNorthHalfSpace));
+		for (i = 0; i < n_bnds; i++) new (&bnds[i]) ANNorthHalfSpace;
+	}
 
 	int j = 0;
 	for (i = 0; i < dim; i++) {					// fill the array
@@ -437,3 +474,86 @@ void annBnds2Box(
 		bnds[i].project(inner_box.hi);
 	}
 }
+
+//----------------------------------------------------------------------
+//	ANNarena - storage for the nodes of a tree
+//		The block size is the expected total size (e.g. for the nodes
+//		of a tree of the given size), within [1K, ANN_ARENA_BLOCK], so
+//		that small trees do not take a whole block.
+//----------------------------------------------------------------------
+
+ANNarena::ANNarena(						// constructor
+	size_t				size_hint)		// expected total size
+{
+	blk_size = size_hint;
+	if (blk_size < 1024) blk_size = 1024;
+	if (blk_size > ANN_ARENA_BLOCK) blk_size = ANN_ARENA_BLOCK;
+
+#ifdef ANN_OMP_TASKS
+	level = omp_get_level();			// the build's team is one deeper
+	n_cursors = omp_get_max_threads();	// threads of a team started here
+#else
+	level = 0;
+	n_cursors = 1;
+#endif
+	cursors = new ANNarenaCursor[n_cursors + 1];
+	for (int t = 0; t <= n_cursors; t++) {
+		cursors[t].next = cursors[t].end = NULL;
+	}
+	blocks = NULL;
+}
+
+ANNarena::~ANNarena()					// destructor
+{
+	while (blocks != NULL) {			// free the list of blocks
+		char *prev = *(char**) blocks;
+		delete [] blocks;
+		blocks = prev;
+	}
+	delete [] cursors;
+}
+
+void *ANNarena::alloc(					// allocate (aligned) storage
+	size_t				size)			// number of bytes
+{
+										// round up to alignment
+	size = (size + ANN_ARENA_ALIGN-1) & ~(size_t) (ANN_ARENA_ALIGN-1);
+
+	int t = 0;							// cursor of this thread
+#ifdef ANN_OMP_TASKS
+	if (omp_get_level() > level) {		// in the team of the build
+		t = omp_get_thread_num();
+		if (t >= n_cursors) {			// no cursor of its own, share one
+			void *p;
+#pragma omp critical (ANNarenaShared)
+			p = bump(cursors[n_cursors], size);
+			return p;
+		}
+	}
+#endif
+	return bump(cursors[t], size);
+}
+
+void *ANNarena::bump(					// allocate from a cursor
+	ANNarenaCursor		&c,				// the cursor
+	size_t				size)			// number of bytes (aligned)
+{
+	if ((size_t) (c.end - c.next) < size) {	// does not fit, new block
+		size_t bs = size + ANN_ARENA_ALIGN;	// ...first bytes hold the link
+		if (bs < blk_size) bs = blk_size;
+		char *blk = new char[bs];
+#ifdef ANN_OMP_TASKS
+#pragma omp critical (ANNarena)
+#endif
+		{
+			*(char**) blk = blocks;		// link it into the list
+			blocks = blk;
+		}
+		c.next = blk + ANN_ARENA_ALIGN;
+		c.end = blk + bs;
+	}
+
+	void *p = c.next;
+	c.next += size;
+	return p;
+}
@@ -27,6 +27,101 @@
 
 #include "kd_tree.h"					// kd-tree declarations
 
+//----------------------------------------------------------------------
+//	Parallel construction
+//		If ANN is compiled with OpenMP 3.0 or later (which has tasks),
+//		trees of at least ANN_PAR_BUILD points are built by a team of
+//		threads: the two subtrees of a large splitting node are built
+//		as separate tasks, and the scans for the minimum and maximum
+//		coordinates of a large point set are split into one task per
+//		thread.  With older OpenMP (e.g. Visual C++'s 2.0) or without
+//		OpenMP, trees are built serially as before.
+//----------------------------------------------------------------------
+
+#if defined(_OPENMP) && _OPENMP >= 200805
+	#include <omp.h>					// OpenMP runtime
+	#define ANN_OMP_TASKS				// build with tasks
+#endif
+
+const int ANN_PAR_BUILD = 20000;		// points for a parallel build step
+
+//----------------------------------------------------------------------
+//	Node arena
+//		An ANNarena holds the nodes of one tree (and the bounds of its
+//		shrinking nodes).  They are cut from large blocks by bumping a
+//		pointer, and are all released at once when the arena is
+//		deleted, without walking the tree.  Their destructors are not
+//		called, so anything a node points to must be in the arena too
+//		(or, like the buckets in pidx, belong to the tree).
+//
+//		Every thread of the team which builds the tree (the team of a
+//		parallel region started where the arena is created) bumps its
+//		own block, so only taking a new block is done in a critical
+//		section.  The arena has a cursor for each thread of such a team
+//		(omp_get_max_threads() when it is created).  Outside that team
+//		(e.g. a tree built by one thread of an enclosing parallel
+//		region) the arena is only used by one thread, and cursor 0 is
+//		used whatever its thread number.  A thread of the team with no
+//		cursor of its own (a team larger than expected) shares one more
+//		cursor, in a critical section.  Blocks are blk_size bytes,
+//		larger requests get a block of their own.
+//----------------------------------------------------------------------
+
+const int ANN_ARENA_BLOCK = 64*1024;	// default (and largest) block size
+const int ANN_ARENA_ALIGN = 16;			// alignment of allocations
+
+class ANNarena {
+	struct ANNarenaCursor {				// where one thread allocates
+		char			*next;			// next free byte
+		char			*end;			// end of its block
+		char			pad[64 - 2*sizeof(char*)];	// own cache line
+	};
+
+	size_t				blk_size;		// size of a block
+	int					level;			// parallel level where created
+	int					n_cursors;		// number of per-thread cursors
+	ANNarenaCursor		*cursors;		// one cursor per thread (and
+										// ...one shared, at n_cursors)
+	char				*blocks;		// last block (each one starts
+										// ...with a link to the previous)
+
+	void *bump(							// allocate from a cursor
+		ANNarenaCursor	&c,				// the cursor
+		size_t			size);			// number of bytes (aligned)
+public:
+	ANNarena(							// constructor
+		size_t			size_hint = ANN_ARENA_BLOCK);	// expected total size
+
+	~ANNarena();						// destructor (frees all blocks)
+
+	void *alloc(						// allocate (aligned) storage
+		size_t			size);			// number of bytes
+};
+
+//----------------------------------------------------------------------
+//	Mapped file
+//		An ANNimage is a file mapped read-only into memory, which
+//		holds the binary image of a tree (see kd_image.cpp).  The
+//		arrays of a tree loaded from an image point into the mapping,
+//		so it must live as long as the tree, which owns it.  Since
+//		ANNpointArray is an array of pointers, which cannot be stored
+//		in a file, the image also holds the pointers to the points
+//		(pts), which are set up when the tree is loaded.
+//----------------------------------------------------------------------
+
+class ANNimage {
+public:
+	char				*base;			// start of the mapping
+	size_t				size;			// size of the file
+	void				*handle;		// mapping object (Win32 only)
+	ANNpointArray		pts;			// pointers to the points
+
+	ANNimage(							// constructor (maps the file)
+		const char		*file);			// file name
+
+	~ANNimage();						// destructor (unmaps it)
+};
+
 //----------------------------------------------------------------------
 //	externally accessible functions
 //----------------------------------------------------------------------
@@ -112,7 +207,8 @@ void annBox2Bnds(				// convert inner box to bounds
 	const ANNorthRect	&bnd_box,		// enclosing box
 	int					dim,			// dimension of space
 	int					&n_bnds,		// number of bounds (returned)
-	ANNorthHSArray		&bnds);			// bounds array (returned)
+	ANNorthHSArray		&bnds,			// bounds array (returned)
+	ANNarena			*arena = NULL);	// storage for bounds (or heap)
 
 void annBnds2Box(				// convert bounds to inner box
 	const ANNorthRect	&bnd_box,		// enclosing box
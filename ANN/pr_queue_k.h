@@ -53,16 +53,37 @@ const PQKinfo	PQ_NULL_INFO =  ANN_NULL_IDX;	// nonexistent info value
 //		PQKinfo).  The special info and key values PQ_NULL_INFO and
 //		PQ_NULL_KEY means that thise entry is empty.
 //
-//		It is currently implemented using an array with k items.
-//		Items are stored in increasing sorted order, and insertions
-//		are made through standard insertion sort.  (This is quite
-//		inefficient, but current applications call for small values
-//		of k and relatively few insertions.)
+//		It is implemented in one of three ways, depending on k:
+//
+//		k <= ANN_MIN_K_HEAP:
+//				An array with k items, stored in increasing sorted
+//				order.  Insertions are made through standard insertion
+//				sort, which is fastest for small and moderate k, as
+//				new items tend to go near the end.  For k = 1 the list
+//				is kept in the structure itself, so that nothing is
+//				allocated.  The search routines also have leaf loops
+//				for k = 1 (see kd_search.cpp and kd_flat.cpp), which
+//				keep the closest point of a leaf in registers and
+//				insert only that one.
+//
+//		k > ANN_MIN_K_HEAP:
+//				A binary max-heap of the k items, so that an insertion
+//				takes O(log k) instead of O(k).  The heap is sorted
+//				(in place) when the results are first extracted, and
+//				is rebuilt if items are inserted after that.
 //		
 //		Note that the list contains k+1 entries, but the last entry
 //		is used as a simple placeholder and is otherwise ignored.
+//
+//		Until the list is full, max_key() returns the bound given to
+//		reset() (PQ_NULL_KEY by default) rather than PQ_NULL_KEY.  The
+//		searches only insert keys which do not exceed max_key(), so a
+//		bound limits a search to points within that (squared) distance,
+//		and prunes all cells which are further away.
 //----------------------------------------------------------------------
 
+const int ANN_MIN_K_HEAP = 128;		// larger k are kept in a heap
+
 class ANNmin_k {
 	struct mk_node {					// node in min_k structure
 		PQKkey			key;			// key value
@@ -71,44 +92,131 @@ class ANNmin_k {
 
 	int			k;						// max number of keys to store
 	int			n;						// number of keys currently active
+	PQKkey		bound;					// max key while not full
+	ANNbool		heap;					// is the list a max-heap?
+	ANNbool		sorted;					// ...which has been sorted?
+	int			max_pos;				// position of max key when full
+	mk_node		one[2];					// the list for k = 1
 	mk_node		*mk;					// the list itself
 
-public:
-	ANNmin_k(int max)					// constructor (given max size)
+	void init(int max)					// set up for max items
 		{
 			n = 0;						// initially no items
 			k = max;					// maximum number of items
-			mk = new mk_node[max+1];	// sorted array of keys
+			bound = PQ_NULL_KEY;		// no bound
+			heap = (ANNbool) (k > ANN_MIN_K_HEAP);
+			sorted = ANNfalse;
+			max_pos = (heap ? 0 : k-1);
+			mk = (k <= 1 ? one : new mk_node[max+1]);
+		}
+
+	void sift_down(						// move item down the heap
+		int i,							// from position i
+		int m,							// heap is mk[0..m-1]
+		mk_node item)					// the item to place
+		{
+			for (;;) {
+				int c = 2*i + 1;		// larger child of i
+				if (c >= m) break;
+				if (c+1 < m && mk[c+1].key > mk[c].key) c++;
+				if (mk[c].key <= item.key) break;
+				mk[i] = mk[c];			// move child up
+				i = c;
+			}
+			mk[i] = item;
+		}
+
+	void make_heap()					// rebuild heap from sorted list
+		{
+			for (int i = n/2 - 1; i >= 0; i--) sift_down(i, n, mk[i]);
+			sorted = ANNfalse;
+			max_pos = 0;
+		}
+
+	void sort_heap()					// sort heap in increasing order
+		{
+			for (int m = n-1; m > 0; m--) {
+				mk_node item = mk[m];	// move max to the end
+				mk[m] = mk[0];
+				sift_down(0, m, item);
+			}
+			sorted = ANNtrue;
+			max_pos = k-1;
+		}
+
+	void heap_insert(					// insert item into heap
+		PQKkey kv,						// key value
+		PQKinfo inf)					// item info
+		{
+			if (sorted) make_heap();
+			mk_node item;
+			item.key = kv;
+			item.info = inf;
+			if (n < k) {				// not full, sift up
+				int i = n++;
+				while (i > 0 && mk[(i-1)/2].key < kv) {
+					mk[i] = mk[(i-1)/2];
+					i = (i-1)/2;
+				}
+				mk[i] = item;
+			}
+			else if (kv < mk[0].key)	// replace the max
+				sift_down(0, n, item);
 		}
+
+public:
+	ANNmin_k(int max)					// constructor (given max size)
+		{  init(max);  }
 		
-	ANNmin_k()
-	{
-			n = 0;						// initially no items
-			k = 1;					// maximum number of items
-			mk = new mk_node[2];
-	}
+	ANNmin_k()							// constructor (k = 1)
+		{  init(1);  }
 	
 	~ANNmin_k()							// destructor
-		{ delete [] mk; }
+		{ if (mk != one) delete [] mk; }
 
+	void reset(							// remove all items (for reuse)
+		PQKkey max = PQ_NULL_KEY)		// bound on keys of new items
+		{
+			n = 0;
+			bound = max;
+			if (heap) {  sorted = ANNfalse;  max_pos = 0;  }
+		}
+
+	int max_k()							// return max number of items
+		{ return k; }
 	
 	PQKkey ANNmin_key()					// return minimum key
-		{ return (n > 0 ? mk[0].key : PQ_NULL_KEY); }
+		{
+			if (heap && !sorted && n > 0) sort_heap();
+			return (n > 0 ? mk[0].key : PQ_NULL_KEY);
+		}
 	
 	PQKkey max_key()					// return maximum key
-		{ return (n == k ? mk[k-1].key : PQ_NULL_KEY); }
+		{ return (n == k ? mk[max_pos].key : bound); }
 	
 	PQKkey ith_smallest_key(int i)		// ith smallest key (i in [0..n-1])
-		{ return (i < n ? mk[i].key : PQ_NULL_KEY); }
+		{
+			if (heap && !sorted) sort_heap();
+			return (i < n ? mk[i].key : PQ_NULL_KEY);
+		}
 	
 	PQKinfo ith_smallest_info(int i)	// info for ith smallest (i in [0..n-1])
-		{ return (i < n ? mk[i].info : PQ_NULL_INFO); }
+		{
+			if (heap && !sorted) sort_heap();
+			return (i < n ? mk[i].info : PQ_NULL_INFO);
+		}
 
 	inline void insert(					// insert item (inlined for speed)
 		PQKkey kv,						// key value
 		PQKinfo inf)					// item info
 		{
-			register int i;
+			if (heap) {
+				heap_insert(kv, inf);
+				ANN_FLOP(2)				// increment floating ops
+				return;
+			}
+
+			int i;
 										// slide larger values up
 			for (i = n; i > 0; i--) {
 				if (mk[i-1].key > kv)
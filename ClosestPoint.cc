@@ -35,12 +35,29 @@
 //
 //=============================================================================
 
+#include <algorithm>
 #include "ClosestPoint.hh"
 #include "ANN/pr_queue_k.h"
+#include "ANN/ANNperf.h"
+
+/// add the counters of ANN searches to _stats
+static void add_stats(SearchStats & _stats, const ANNsearchStats & _ann)
+{
+    _stats.queries   += _ann.n_queries;
+    _stats.nodes     += _ann.n_spl;
+    _stats.leaves    += _ann.n_lf;
+    _stats.points    += _ann.n_pts;
+    _stats.leafHits  += _ann.n_lf_hit;
+    _stats.earlyOuts += _ann.n_early;
+}
 
 ClosestPoint::
-ClosestPoint()
+ClosestPoint(Backend _backend)
 {
+    backend_ = _backend;
+    eps_ = 0;
+    maxPtsVisited_ = 0;
+    cellSize_ = 0;
     dataPoints_ = NULL;
     kDTree_ = NULL;
 }
@@ -66,6 +83,51 @@ release()
         delete dataPoints_;
         dataPoints_ = NULL;
     }
+    tree3d_.clear();
+    tree3f_.clear();
+    grid_.clear();
+}
+
+void
+ClosestPoint::
+setBackend(Backend _backend)
+{
+    if( _backend == backend_ )
+        return;
+
+    // queries dispatch on backend_, never leave it naming an unbuilt structure
+    release();
+    backend_ = _backend;
+}
+
+const char *
+ClosestPoint::
+backendName(Backend _backend)
+{
+    switch( _backend ) {
+        case ANN_KDTREE:     return "ANN kd-tree";
+        case KDTREE3_DOUBLE: return "KdTree3<double>";
+        case KDTREE3_FLOAT:  return "KdTree3<float>";
+        case ANN_BDTREE:     return "ANN bd-tree";
+        case HASH_GRID:      return "HashGrid3<double>";
+    }
+    return "unknown";
+}
+
+void
+ClosestPoint::
+setApproximation(
+    double _eps,
+    int _maxPtsVisited
+)
+{
+    eps_ = _eps;
+    maxPtsVisited_ = _maxPtsVisited;
+
+    tree3d_.setApproximation( eps_, maxPtsVisited_ );
+    tree3f_.setApproximation( eps_, maxPtsVisited_ );
+    if( kDTree_ )
+        kDTree_->setMaxPtsVisit( maxPtsVisited_ );
 }
 
 void
@@ -76,6 +138,19 @@ init(
 {
     release();
 
+    if( backend_ == KDTREE3_DOUBLE ) {
+        tree3d_.build( _pts );
+        return;
+    }
+    if( backend_ == KDTREE3_FLOAT ) {
+        tree3f_.build( _pts );
+        return;
+    }
+    if( backend_ == HASH_GRID ) {
+        grid_.build( _pts, cellSize_ );
+        return;
+    }
+
     dataPoints_ = new ANNpointArray;
     *dataPoints_ = annAllocPts(_pts.size(),3); // allocate data points
 
@@ -85,11 +160,25 @@ init(
         (*dataPoints_)[i][2] = _pts[i][2];
     }
 
-    kDTree_ = new ANNkd_tree(       // build search structure
-            *dataPoints_,                   // the data points
-            _pts.size(),    // number of points
-            3               // dimension of space
-    );
+    if( backend_ == ANN_BDTREE )
+        kDTree_ = new ANNbd_tree(   // build search structure
+                *dataPoints_,               // the data points
+                _pts.size(),    // number of points
+                3,              // dimension of space
+                16,             // bucket size
+                ANN_KD_SUGGEST, // splitting rule
+                ANN_BD_SUGGEST  // shrinking rule
+        );
+    else
+        kDTree_ = new ANNkd_tree(   // build search structure
+                *dataPoints_,               // the data points
+                _pts.size(),    // number of points
+                3,              // dimension of space
+                16,             // bucket size (searched 4 points at a time)
+                ANN_KD_SUGGEST, // splitting rule
+                ANN_LAYOUT_FLAT // nodes in one array
+        );
+    kDTree_->setMaxPtsVisit( maxPtsVisited_ );
 
 }
 
@@ -99,33 +188,157 @@ getClosestPoint(
         const Vector3d & _queryVertex
 )
 {
+    double dist2;
+    return getClosestPoint( _queryVertex, dist2 );
+}
+
+int     // returns index
+ClosestPoint::
+getClosestPoint(
+        const Vector3d & _queryVertex,
+        double & _dist2,
+        double _maxDist2,
+        SearchStats * _stats
+)
+{
+    if( backend_ == KDTREE3_DOUBLE )
+        return tree3d_.closest( _queryVertex, _dist2, _maxDist2, -1, _stats );
+    if( backend_ == KDTREE3_FLOAT )
+        return tree3f_.closest( _queryVertex, _dist2, _maxDist2, -1, _stats );
+    if( backend_ == HASH_GRID )
+        return grid_.closest( _queryVertex, _dist2, _maxDist2, _stats );
+
+    // not built (yet, or since setBackend()), like the other backends
+    if( !kDTree_ ) {
+        _dist2 = std::numeric_limits< double >::max();
+        return -1;
+    }
 
     // initialize ANN types for wrapping
-    ANNpoint queryPt;                           // query point
+    ANNcoord queryCoords[3];                    // query point storage
+    ANNpoint queryPt = queryCoords;             // query point
     ANNidx nnIdx[1];                            // near neighbor indices
     ANNdist dists[1];                           // near neighbor distances
 
-    queryPt = annAllocPt(3);                    // allocate query point
-
     // assign values to ANN query point
 
     queryPt[0] = _queryVertex[0];
     queryPt[1] = _queryVertex[1];
     queryPt[2] = _queryVertex[2];
 
+    // the bound prunes all cells further away than _maxDist2
     ANNmin_k mink;
+    mink.reset( _maxDist2 );
     int ptsVisited=0;
+    ANNsearchStats annStats;
 
     kDTree_->ann1Search(            // search
         &queryPt,               // query point
         nnIdx,                  // nearest neighbors (returned)
         dists,                  // distance (returned)
-        0,
+        eps_,                   // epsilon error bound
         &mink,
-        ptsVisited);                        // epsilon error bound
+        ptsVisited,
+        _stats ? &annStats : NULL);
+
+    if( _stats ) add_stats( *_stats, annStats );
+
+    _dist2 = dists[0];
+    return nnIdx[0];            // ANN_NULL_IDX (-1) if none within bound
+}
+
+void
+ClosestPoint::
+getClosestPoints(
+        const std::vector< Vector3d > & _queryVertices,
+        std::vector< int > & _indices,
+        std::vector< double > & _dist2,
+        double _maxDist2,
+        const std::vector< int > * _hints,
+        SearchStats * _stats
+)
+{
+    int numQueries = (int) _queryVertices.size();
+    bool useHints = ( _hints != NULL && (int) _hints->size() == numQueries );
+    _indices.resize( numQueries );
+    _dist2.resize( numQueries );
+    if( numQueries == 0 ) return;
 
+    // (taken after resizing, _hints may be _indices)
+    const int * hints = useHints ? &(*_hints)[0] : NULL;
 
-    annDeallocPt(queryPt);
+    if( !annBackend() ) {
+#pragma omp parallel
+        {
+            SearchStats stats;
+            SearchStats * st = _stats ? &stats : NULL;
 
-    return nnIdx[0];
+#pragma omp for schedule(dynamic,256)
+            for(int i = 0; i < numQueries; i++) {
+                int hint = hints ? hints[i] : -1;
+                if( backend_ == KDTREE3_DOUBLE )
+                    _indices[i] = tree3d_.closest( _queryVertices[i], _dist2[i], _maxDist2, hint, st );
+                else if( backend_ == KDTREE3_FLOAT )
+                    _indices[i] = tree3f_.closest( _queryVertices[i], _dist2[i], _maxDist2, hint, st );
+                else
+                    _indices[i] = grid_.closest( _queryVertices[i], _dist2[i], _maxDist2, st );
+            }
+
+            if( _stats ) {
+#pragma omp critical (ClosestPointStats)
+                *_stats += stats;
+            }
+        }
+        return;
+    }
+
+    if( !kDTree_ ) {
+        std::fill( _indices.begin(), _indices.end(), -1 );
+        std::fill( _dist2.begin(), _dist2.end(), std::numeric_limits< double >::max() );
+        return;
+    }
+
+    int numPoints = kDTree_->nPoints();
+
+    // ann1Search is re-entrant, so all threads share the one tree
+#pragma omp parallel
+    {
+        // search state is set up once per thread and reused for every query
+        ANNcoord queryCoords[3];
+        ANNpoint queryPt = queryCoords;
+        ANNmin_k mink;
+        ANNsearchStats annStats;
+        ANNsearchStats * st = _stats ? &annStats : NULL;
+
+#pragma omp for schedule(dynamic,256)
+        for(int i = 0; i < numQueries; i++) {
+            ANNidx nnIdx;
+            ANNdist dist;
+
+            queryPt[0] = _queryVertices[i][0];
+            queryPt[1] = _queryVertices[i][1];
+            queryPt[2] = _queryVertices[i][2];
+
+            int ptsVisited = 0;
+            mink.reset( _maxDist2 );
+
+            // the hint, if it is close enough, is the first candidate
+            int hint = hints ? hints[i] : -1;
+            if( hint >= 0 && hint < numPoints ) {
+                ANNdist hintDist = annDist( 3, queryPt, (*dataPoints_)[hint] );
+                if( hintDist < mink.max_key() )
+                    mink.insert( hintDist, hint );
+            }
+
+            kDTree_->ann1Search( &queryPt, &nnIdx, &dist, eps_, &mink, ptsVisited, st );
+
+            _indices[i] = nnIdx;
+            _dist2[i] = dist;
+        }
+
+        if( _stats ) {
+#pragma omp critical (ClosestPointStats)
+            add_stats( *_stats, annStats );
+        }
+    }
 }
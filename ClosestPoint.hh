@@ -39,19 +39,39 @@
 #define CLOSESTPOINT_HPP_
 
 #include <vector>
+#include <limits>
 #include "ANN/ANN.h"
+#include "KdTree3.hh"
+#include "HashGrid3.hh"
+#include "SearchStats.hh"
 #include "Vector.hh"
 
 /**
  * ClosestPoint class
  *
- * class that allows efficient closest point lookup using KD-tree (ANN library)
+ * class that allows efficient closest point lookup using KD-tree (ANN library
+ * or KdTree3) or a hashed uniform grid (HashGrid3)
+ *
+ * All queries take an optional SearchStats, to which they add what they
+ * visited, whatever the backend.
  */
 class ClosestPoint
 {
 public:
+    /// search structures available for the lookup
+    enum Backend {
+        ANN_KDTREE,         ///< ANN kd-tree (flat layout), double precision
+        KDTREE3_DOUBLE,     ///< KdTree3<double>
+        KDTREE3_FLOAT,      ///< KdTree3<float>, half the memory
+        ANN_BDTREE,         ///< ANN bd-tree, double precision
+        HASH_GRID           ///< HashGrid3<double>, exact only, fastest to build
+    };
+
+    /// name of a search structure
+    static const char * backendName(Backend _backend);
+
     /// constructor
-    ClosestPoint();
+    ClosestPoint(Backend _backend = ANN_KDTREE);
 
     /// destructor
     ~ClosestPoint();
@@ -62,16 +82,103 @@ public:
     /// release data
     void release();
 
+    /// select search structure; switching releases the current one, so
+    /// init() has to be called again before the next query
+    void setBackend(Backend _backend);
+
+    /// set the cell size of the HASH_GRID backend, best about six times the
+    /// point spacing (0: estimate from the points), takes effect at the next
+    /// init()
+    void setCellSize(double _cellSize) { cellSize_ = _cellSize; }
+
+    /// search structure in use
+    Backend backend() const { return backend_; }
+
+    /// make the queries approximate: a point returned may be up to a factor
+    /// 1+_eps further away than the closest one, and a search stops after
+    /// visiting _maxPtsVisited points (0 = no limit). Applies to this object
+    /// only, (0, 0) is exact (the default). HASH_GRID queries are always exact
+    void setApproximation(double _eps, int _maxPtsVisited = 0);
+
+    /// error bound of the queries
+    double eps() const { return eps_; }
+
     /// retrieve closest point of query
     int getClosestPoint(const Vector3d & _queryVertex);
 
+    /// retrieve closest point of query and its squared distance; only points
+    /// within distance sqrt(_maxDist2) are considered, if there is none
+    /// -1 is returned
+    int getClosestPoint(
+        const Vector3d & _queryVertex,
+        double & _dist2,
+        double _maxDist2 = std::numeric_limits< double >::max(),
+        SearchStats * _stats = NULL );
+
+    /// retrieve closest point of query within distance sqrt(_maxDist2),
+    /// e.g. the rejection threshold of ICP, and its squared distance (-1 if
+    /// there is none); the bound prunes the search, so far queries are cheap
+    int getClosestPointWithin(
+        const Vector3d & _queryVertex,
+        double _maxDist2,
+        double & _dist2,
+        SearchStats * _stats = NULL )
+    { return getClosestPoint( _queryVertex, _dist2, _maxDist2, _stats ); }
+
+    /// retrieve closest points within distance sqrt(_maxDist2) of all
+    /// queries in parallel (index -1 if there is none)
+    void getClosestPointsWithin(
+        const std::vector< Vector3d > & _queryVertices,
+        double _maxDist2,
+        std::vector< int > & _indices,
+        std::vector< double > & _dist2,
+        const std::vector< int > * _hints = NULL,
+        SearchStats * _stats = NULL )
+    { getClosestPoints( _queryVertices, _indices, _dist2, _maxDist2, _hints, _stats ); }
+
+    /// retrieve closest points of all queries in parallel,
+    /// returning indices and squared distances (index -1 if there is no
+    /// point within distance sqrt(_maxDist2)).
+    /// _hints optionally gives a guess for each query (-1 for none), e.g.
+    /// its result in the previous ICP iteration. A search starts with its
+    /// guess as the best point so far, so a good guess leaves little of the
+    /// tree to visit; the result does not depend on the guesses. _hints may
+    /// be the same vector as _indices.
+    /// Each thread counts its queries apart, they are added to _stats (if
+    /// given) at the end.
+    void getClosestPoints(
+        const std::vector< Vector3d > & _queryVertices,
+        std::vector< int > & _indices,
+        std::vector< double > & _dist2,
+        double _maxDist2 = std::numeric_limits< double >::max(),
+        const std::vector< int > * _hints = NULL,
+        SearchStats * _stats = NULL );
+
 private:
+    /// search structure built by init()
+    Backend backend_;
+
+    /// true if the search structure is an ANN tree
+    bool annBackend() const { return backend_ == ANN_KDTREE || backend_ == ANN_BDTREE; }
+
+    /// approximation settings
+    double eps_;
+    int maxPtsVisited_;
+
     /// data points only used when ANN search is performed
     ANNpointArray * dataPoints_;
 
     /// kd tree search structure
     ANNkd_tree * kDTree_;
 
+    /// search structures of the KdTree3 backends
+    KdTree3< double > tree3d_;
+    KdTree3< float > tree3f_;
+
+    /// search structure of the HASH_GRID backend and its cell size
+    HashGrid3< double > grid_;
+    double cellSize_;
+
 };
 
 
@@ -0,0 +1,400 @@
+//=============================================================================
+//
+//   Code framework for the lecture
+//
+//   "Surface Representation and Geometric Modeling"
+//
+//   Mark Pauly, Mario Botsch, Balint Miklos, and Hao Li
+//
+//   Copyright (C) 2007 by  Applied Geometry Group and
+//                          Computer Graphics Laboratory, ETH Zurich
+//
+//-----------------------------------------------------------------------------
+//
+//                                License
+//
+//   This program is free software; you can redistribute it and/or
+//   modify it under the terms of the GNU General Public License
+//   as published by the Free Software Foundation; either version 2
+//   of the License, or (at your option) any later version.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program; if not, write to the Free Software
+//   Foundation, Inc., 51 Franklin Street, Fifth Floor,
+//   Boston, MA  02110-1301, USA.
+//
+//=============================================================================
+//=============================================================================
+//
+//  CLASS HashGrid3
+//
+//=============================================================================
+
+
+#ifndef HASHGRID3_HH_
+#define HASHGRID3_HH_
+
+#include <vector>
+#include <limits>
+#include <algorithm>
+#include <cmath>
+#include "Vector.hh"
+#include "SearchStats.hh"
+
+/**
+ * HashGrid3 class
+ *
+ * uniform grid of cubic cells for closest point queries in 3D, with the
+ * coordinates stored as T (float or double). Only non-empty cells are stored;
+ * they are found through a hash table on the integer cell coordinates, so the
+ * memory is linear in the number of points however large the bounding box.
+ *
+ * Building is O(n): every point is hashed once, then the points are copied
+ * so that each cell is one contiguous run. A query searches the cells in
+ * shells of growing distance around the query's cell and stops when the next
+ * shell cannot hold a closer point. For point sets of roughly uniform
+ * density (like scans) with cells a few point spacings wide, a query takes
+ * expected O(1) time, in particular if the search radius is bounded. On
+ * scans, cells of about six point spacings (some 40 points per non-empty
+ * cell) were fastest to build and to query.
+ */
+template <class T>
+class HashGrid3
+{
+public:
+    /// point type used for storage
+    typedef Vector<T,3> Point;
+
+    /// constructor: empty grid
+    HashGrid3() : cellSize_(0), invCellSize_(0), mask_(0) {}
+
+    /// build grid for _pts with cells of edge length _cellSize; if that is
+    /// not positive, it is estimated from the bounding box assuming the
+    /// points sample a surface
+    void build(const std::vector< Vector3d > & _pts, double _cellSize = 0);
+
+    /// release data
+    void clear();
+
+    /// number of points in the grid
+    int size() const { return (int) indices_.size(); }
+
+    /// edge length of the cells
+    double cellSize() const { return cellSize_; }
+
+    /// retrieve index of closest point of _query and its squared distance,
+    /// considering only points closer than sqrt(_maxDist2) (-1 if there is
+    /// none); the search only visits cells within that distance. The query
+    /// is counted in _stats, if given: the cells looked up as nodes, the
+    /// non-empty ones as leaves
+    int closest(const Vector3d & _query, double & _dist2,
+                double _maxDist2 = std::numeric_limits< double >::max(),
+                SearchStats * _stats = NULL) const;
+
+private:
+    /// non-empty cell: integer coordinates and run of points
+    struct Cell {
+        int x, y, z;
+        int first, n;
+    };
+
+    /// hash of integer cell coordinates
+    static unsigned int hash(int _x, int _y, int _z)
+    {
+        return ( (unsigned int) _x * 73856093u ) ^
+               ( (unsigned int) _y * 19349663u ) ^
+               ( (unsigned int) _z * 83492791u );
+    }
+
+    /// distance (in cell units) of coordinate _f from the cells with index _i
+    static T axisDist(T _f, int _i)
+    {
+        return ( _f < _i ) ? _i - _f : ( _f > _i + 1 ) ? _f - _i - 1 : 0;
+    }
+
+    /// index in cells_ of the cell at (_x, _y, _z), -1 if it is empty
+    int findCell(int _x, int _y, int _z) const;
+
+    /// search the points of cell _cell
+    void searchCell(const Cell & _cell, const T * _q, int & _best, T & _bestDist2) const;
+
+private:
+    /// edge length of the cells and its inverse
+    double cellSize_;
+    T invCellSize_;
+
+    /// lower corner of cell (0,0,0), and number of cells per coordinate
+    /// covering the points
+    Point origin_;
+    int dims_[3];
+
+    /// hash table (size a power of two, open addressing) of indices into
+    /// cells_, -1 for free slots
+    std::vector< int > table_;
+    unsigned int mask_;
+
+    /// non-empty cells
+    std::vector< Cell > cells_;
+
+    /// points in cell order
+    std::vector< Point > points_;
+
+    /// original index of each point in points_
+    std::vector< int > indices_;
+};
+
+
+//=============================================================================
+
+
+template <class T>
+void
+HashGrid3<T>::
+clear()
+{
+    std::vector< int >().swap( table_ );
+    std::vector< Cell >().swap( cells_ );
+    std::vector< Point >().swap( points_ );
+    std::vector< int >().swap( indices_ );
+    mask_ = 0;
+}
+
+
+template <class T>
+void
+HashGrid3<T>::
+build(
+    const std::vector< Vector3d > & _pts,
+    double _cellSize
+)
+{
+    clear();
+
+    int n = (int) _pts.size();
+    if( n == 0 ) return;
+
+    // bounding box
+    Vector3d lo = _pts[0], hi = lo;
+    for(int i = 1; i < n; i++) {
+        for(int d = 0; d < 3; d++) {
+            if( _pts[i][d] < lo[d] ) lo[d] = _pts[i][d];
+            if( _pts[i][d] > hi[d] ) hi[d] = _pts[i][d];
+        }
+    }
+
+    // estimate the cell size: a surface spanning the two largest extents
+    // of the box, with cells about six point spacings wide
+    if( _cellSize <= 0 ) {
+        double ext[3] = { hi[0] - lo[0], hi[1] - lo[1], hi[2] - lo[2] };
+        std::sort( ext, ext + 3 );
+        _cellSize = 6.0 * std::sqrt( ext[2] * ext[1] / n );
+        if( !( _cellSize > 0 ) ) _cellSize = std::max( ext[2], 1.0 );
+    }
+
+    cellSize_ = _cellSize;
+    invCellSize_ = (T) ( 1.0 / _cellSize );
+    for(int d = 0; d < 3; d++) {
+        origin_[d] = (T) lo[d];
+        dims_[d] = (int) ( ( hi[d] - lo[d] ) / _cellSize ) + 1;
+    }
+
+    // hash table with at least twice as many slots as there can be cells
+    unsigned int tableSize = 16;
+    while( tableSize < 2u * (unsigned int) n ) tableSize *= 2;
+    table_.assign( tableSize, -1 );
+    mask_ = tableSize - 1;
+
+    // find (or add) the cell of every point, and count its points
+    std::vector< Point > pts( n );
+    std::vector< int > cellOf( n );
+    for(int i = 0; i < n; i++) {
+        int c[3];
+        for(int d = 0; d < 3; d++) {
+            pts[i][d] = (T) _pts[i][d];
+            c[d] = std::min( (int) ( ( pts[i][d] - origin_[d] ) * invCellSize_ ), dims_[d] - 1 );
+            if( c[d] < 0 ) c[d] = 0;
+        }
+
+        unsigned int slot = hash( c[0], c[1], c[2] ) & mask_;
+        while( table_[slot] >= 0 ) {
+            const Cell & cell = cells_[ table_[slot] ];
+            if( cell.x == c[0] && cell.y == c[1] && cell.z == c[2] ) break;
+            slot = ( slot + 1 ) & mask_;
+        }
+        if( table_[slot] < 0 ) {
+            Cell cell;
+            cell.x = c[0];
+            cell.y = c[1];
+            cell.z = c[2];
+            cell.first = 0;
+            cell.n = 0;
+            table_[slot] = (int) cells_.size();
+            cells_.push_back( cell );
+        }
+        cellOf[i] = table_[slot];
+        cells_[ cellOf[i] ].n++;
+    }
+
+    // runs of the cells, then copy the points into them
+    int first = 0;
+    for(int c = 0; c < (int) cells_.size(); c++) {
+        cells_[c].first = first;
+        first += cells_[c].n;
+    }
+    std::vector< int > fill( cells_.size() );
+    for(int c = 0; c < (int) cells_.size(); c++) fill[c] = cells_[c].first;
+
+    points_.resize( n );
+    indices_.resize( n );
+    for(int i = 0; i < n; i++) {
+        int pos = fill[ cellOf[i] ]++;
+        points_[pos] = pts[i];
+        indices_[pos] = i;
+    }
+}
+
+
+template <class T>
+int
+HashGrid3<T>::
+findCell(
+    int _x,
+    int _y,
+    int _z
+) const
+{
+    unsigned int slot = hash( _x, _y, _z ) & mask_;
+    while( table_[slot] >= 0 ) {
+        const Cell & cell = cells_[ table_[slot] ];
+        if( cell.x == _x && cell.y == _y && cell.z == _z ) return table_[slot];
+        slot = ( slot + 1 ) & mask_;
+    }
+    return -1;
+}
+
+
+template <class T>
+void
+HashGrid3<T>::
+searchCell(
+    const Cell & _cell,
+    const T * _q,
+    int & _best,
+    T & _bestDist2
+) const
+{
+    const Point * p = &points_[ _cell.first ];
+    for(int i = 0; i < _cell.n; i++) {
+        T dx = _q[0] - p[i][0];
+        T dy = _q[1] - p[i][1];
+        T dz = _q[2] - p[i][2];
+        T dist2 = dx*dx + dy*dy + dz*dz;
+        if( dist2 < _bestDist2 ) {
+            _bestDist2 = dist2;
+            _best = _cell.first + i;
+        }
+    }
+}
+
+
+template <class T>
+int
+HashGrid3<T>::
+closest(
+    const Vector3d & _query,
+    double & _dist2,
+    double _maxDist2,
+    SearchStats * _stats
+) const
+{
+    _dist2 = std::numeric_limits< double >::max();
+    if( cells_.empty() ) return -1;
+
+    T q[3] = { (T) _query[0], (T) _query[1], (T) _query[2] };
+    int best = -1;
+    T bestDist2 = std::numeric_limits< T >::max();
+    if( _maxDist2 < (double) bestDist2 ) bestDist2 = (T) _maxDist2;
+    SearchStats st;
+    st.queries = 1;
+
+    // query in cell units, projected onto the box of the grid. For a point
+    // x in the box, |q-x|^2 >= |q-p|^2 + |p-x|^2 where p is the projection,
+    // so the search works around p with the offset outside2 added
+    T f[3], outside2 = 0;
+    int c[3];
+    for(int d = 0; d < 3; d++) {
+        T fq = ( q[d] - origin_[d] ) * invCellSize_;
+        f[d] = std::max( (T) 0, std::min( (T) dims_[d], fq ) );
+        outside2 += ( fq - f[d] ) * ( fq - f[d] );
+        c[d] = std::min( (int) f[d], dims_[d] - 1 );
+    }
+    T h2 = (T) ( cellSize_ * cellSize_ );
+
+    // shells of cells at Chebyshev distance r from the query's cell
+    for(int r = 0; ; r++) {
+        // a cell in shell r is r cells away from c along some axis, so it is
+        // at least as far as the nearest such slab of the grid (and so are
+        // the cells of the following shells)
+        T bound = std::numeric_limits< T >::max();
+        for(int d = 0; d < 3; d++) {
+            if( c[d] - r >= 0 )
+                bound = std::min( bound, axisDist( f[d], c[d] - r ) );
+            if( c[d] + r < dims_[d] )
+                bound = std::min( bound, axisDist( f[d], c[d] + r ) );
+        }
+        if( bound == std::numeric_limits< T >::max() ) break;  // past the grid
+        if( ( outside2 + bound * bound ) * h2 >= bestDist2 ) break;
+
+        int xLo = std::max( c[0] - r, 0 ), xHi = std::min( c[0] + r, dims_[0] - 1 );
+        int yLo = std::max( c[1] - r, 0 ), yHi = std::min( c[1] + r, dims_[1] - 1 );
+        int zLo = std::max( c[2] - r, 0 ), zHi = std::min( c[2] + r, dims_[2] - 1 );
+
+        for(int x = xLo; x <= xHi; x++) {
+            T ox = axisDist( f[0], x );
+            if( ( outside2 + ox*ox ) * h2 >= bestDist2 ) continue;
+            bool xFace = ( x == c[0] - r || x == c[0] + r );
+
+            for(int y = yLo; y <= yHi; y++) {
+                T oy = axisDist( f[1], y );
+                if( ( outside2 + ox*ox + oy*oy ) * h2 >= bestDist2 ) continue;
+                bool face = xFace || y == c[1] - r || y == c[1] + r;
+
+                for(int z = zLo; z <= zHi; z++) {
+                    // inside the shell only the cells at z = c-r and c+r
+                    if( !face && z != c[2] - r && z != c[2] + r ) {
+                        z = std::max( z, c[2] + r - 1 );
+                        continue;
+                    }
+                    T oz = axisDist( f[2], z );
+
+                    // skip cells further away than the best point so far
+                    if( ( outside2 + ox*ox + oy*oy + oz*oz ) * h2 >= bestDist2 ) continue;
+
+                    int cell = findCell( x, y, z );
+                    st.nodes++;
+                    if( cell >= 0 ) {
+                        int oldBest = best;
+                        searchCell( cells_[cell], q, best, bestDist2 );
+                        st.leaves++;
+                        st.points += cells_[cell].n;
+                        st.leafHits += ( best != oldBest );
+                    }
+                }
+            }
+        }
+    }
+
+    if( _stats ) *_stats += st;
+    if( best < 0 ) return -1;
+    _dist2 = bestDist2;
+    return indices_[best];
+}
+
+
+//=============================================================================
+#endif /* HASHGRID3_HH_ */
@@ -0,0 +1,332 @@
+//=============================================================================
+//
+//   Code framework for the lecture
+//
+//   "Surface Representation and Geometric Modeling"
+//
+//   Mark Pauly, Mario Botsch, Balint Miklos, and Hao Li
+//
+//   Copyright (C) 2007 by  Applied Geometry Group and
+//                          Computer Graphics Laboratory, ETH Zurich
+//
+//-----------------------------------------------------------------------------
+//
+//                                License
+//
+//   This program is free software; you can redistribute it and/or
+//   modify it under the terms of the GNU General Public License
+//   as published by the Free Software Foundation; either version 2
+//   of the License, or (at your option) any later version.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program; if not, write to the Free Software
+//   Foundation, Inc., 51 Franklin Street, Fifth Floor,
+//   Boston, MA  02110-1301, USA.
+//
+//=============================================================================
+//=============================================================================
+//
+//  CLASS IncrementalKdTree3
+//
+//=============================================================================
+
+
+#ifndef INCREMENTALKDTREE3_HH_
+#define INCREMENTALKDTREE3_HH_
+
+#include <vector>
+#include <limits>
+#include <algorithm>
+#include "Vector.hh"
+#include "KdTree3.hh"
+
+/**
+ * IncrementalKdTree3 class
+ *
+ * closest point index in 3D that grows by batches of points, e.g. by one
+ * registered scan at a time. Every point carries a label (the batch's, e.g.
+ * the scan index) and its index within the batch.
+ *
+ * The index uses the logarithmic method: the points are split into levels,
+ * each one a static KdTree3, and each level holds more than twice as many
+ * points as the next. A new batch becomes a level of its own, merged with
+ * (i.e. rebuilt together with) the smaller levels as long as that rule would
+ * be broken. There are thus at most log2(n) levels, and every point is
+ * rebuilt O(log n) times in total, so adding a batch of m points costs
+ * amortized O(m log^2 n) instead of rebuilding the whole index. A query
+ * searches all levels, each one bounded by the best distance found so far.
+ * It can also find the closest point of every label at once, e.g. on each
+ * scan, in a single traversal of each level.
+ */
+template <class T>
+class IncrementalKdTree3
+{
+public:
+    /// constructor: empty index, exact search
+    IncrementalKdTree3() : numLabels_(0), eps_(0), maxPtsVisited_(0) {}
+
+    /// add the points _pts, all labeled _label (>= 0); returns the id of the
+    /// first one, the others follow consecutively
+    int insert(const std::vector< Vector3d > & _pts, int _label);
+
+    /// remove all points
+    void clear();
+
+    /// number of points
+    int size() const { return (int) points_.size(); }
+
+    /// number of levels (static trees)
+    int numLevels() const { return (int) levels_.size(); }
+
+    /// one more than the largest label
+    int numLabels() const { return numLabels_; }
+
+    /// make closest() approximate, see KdTree3::setApproximation()
+    void setApproximation(double _eps, int _maxPtsVisited = 0);
+
+    /// retrieve id of closest point of _query and its squared distance,
+    /// considering only points closer than sqrt(_maxDist2) (-1 if there is
+    /// none). If valid, the level holding point _hint is searched first,
+    /// starting in its leaf. The query is counted in _stats, if given, once;
+    /// the visits add up over the levels
+    int closest(const Vector3d & _query, double & _dist2,
+                double _maxDist2 = std::numeric_limits< double >::max(),
+                int _hint = -1, SearchStats * _stats = NULL) const;
+
+    /// retrieve for every label the id of its closest point to _query and
+    /// their squared distance, as closest() does for all points. _ids and
+    /// _dist2 get numLabels() entries. Each level is searched once for all
+    /// labels. The query is counted in _stats as by closest()
+    void closestPerLabel(const Vector3d & _query, std::vector< int > & _ids,
+                         std::vector< double > & _dist2,
+                         double _maxDist2 = std::numeric_limits< double >::max(),
+                         SearchStats * _stats = NULL) const;
+
+    /// label of point _id
+    int label(int _id) const { return labels_[_id]; }
+
+    /// index of point _id within the batch it was inserted with
+    int index(int _id) const { return indices_[_id]; }
+
+    /// position of point _id
+    const Vector3d & point(int _id) const { return points_[_id]; }
+
+private:
+    /// one static tree (with the labels set) and the ids of its points (in
+    /// the order they were passed to KdTree3::build())
+    struct Level {
+        KdTree3< T >      tree;
+        std::vector< int > ids;
+    };
+
+    /// build the tree of level _level from its ids
+    void buildLevel(int _level);
+
+private:
+    /// levels by decreasing size
+    std::vector< Level > levels_;
+
+    /// position, label and index in batch of each point
+    std::vector< Vector3d > points_;
+    std::vector< int >      labels_;
+    std::vector< int >      indices_;
+
+    /// level of each point and its index in that level's tree
+    std::vector< int >      levelOf_;
+    std::vector< int >      positionOf_;
+
+    /// one more than the largest label
+    int numLabels_;
+
+    /// approximation passed on to the levels
+    double eps_;
+    int    maxPtsVisited_;
+};
+
+
+//=============================================================================
+
+
+template <class T>
+void
+IncrementalKdTree3<T>::
+clear()
+{
+    std::vector< Level >().swap( levels_ );
+    std::vector< Vector3d >().swap( points_ );
+    std::vector< int >().swap( labels_ );
+    std::vector< int >().swap( indices_ );
+    std::vector< int >().swap( levelOf_ );
+    std::vector< int >().swap( positionOf_ );
+    numLabels_ = 0;
+}
+
+
+template <class T>
+void
+IncrementalKdTree3<T>::
+setApproximation(
+    double _eps,
+    int _maxPtsVisited
+)
+{
+    eps_ = _eps;
+    maxPtsVisited_ = _maxPtsVisited;
+    for(int l = 0; l < (int) levels_.size(); l++)
+        levels_[l].tree.setApproximation( eps_, maxPtsVisited_ );
+}
+
+
+template <class T>
+int
+IncrementalKdTree3<T>::
+insert(
+    const std::vector< Vector3d > & _pts,
+    int _label
+)
+{
+    int first = size();
+    int n = (int) _pts.size();
+    if( n == 0 ) return first;
+
+    points_.insert( points_.end(), _pts.begin(), _pts.end() );
+    labels_.resize( first + n, _label );
+    numLabels_ = std::max( numLabels_, _label + 1 );
+    levelOf_.resize( first + n );
+    positionOf_.resize( first + n );
+    std::vector< int > ids( n );
+    for(int i = 0; i < n; i++) {
+        indices_.push_back( i );
+        ids[i] = first + i;
+    }
+
+    // merge with the smaller levels until the new level has less than half
+    // the points of the one below it
+    while( !levels_.empty() && (int) levels_.back().ids.size() <= 2 * (int) ids.size() ) {
+        const std::vector< int > & merged = levels_.back().ids;
+        ids.insert( ids.end(), merged.begin(), merged.end() );
+        levels_.pop_back();
+    }
+
+    levels_.push_back( Level() );
+    levels_.back().ids.swap( ids );
+    buildLevel( (int) levels_.size() - 1 );
+
+    return first;
+}
+
+
+template <class T>
+void
+IncrementalKdTree3<T>::
+buildLevel(int _level)
+{
+    Level & level = levels_[_level];
+    int n = (int) level.ids.size();
+
+    std::vector< Vector3d > pts( n );
+    std::vector< int > labels( n );
+    for(int i = 0; i < n; i++) {
+        pts[i] = points_[ level.ids[i] ];
+        labels[i] = labels_[ level.ids[i] ];
+        levelOf_[ level.ids[i] ] = _level;
+        positionOf_[ level.ids[i] ] = i;
+    }
+
+    level.tree.build( pts );
+    level.tree.setLabels( labels );
+    level.tree.setApproximation( eps_, maxPtsVisited_ );
+}
+
+
+template <class T>
+int
+IncrementalKdTree3<T>::
+closest(
+    const Vector3d & _query,
+    double & _dist2,
+    double _maxDist2,
+    int _hint,
+    SearchStats * _stats
+) const
+{
+    int best = -1;
+    double bestDist2 = _maxDist2;
+    double dist2;
+    SearchStats st;
+    SearchStats * levelStats = _stats ? &st : NULL;
+
+    // the level of the hint first: a close result bounds the search in
+    // all the other levels
+    int hintLevel = -1;
+    if( _hint >= 0 && _hint < size() ) {
+        hintLevel = levelOf_[_hint];
+        const Level & level = levels_[hintLevel];
+        int i = level.tree.closest( _query, dist2, bestDist2, positionOf_[_hint], levelStats );
+        if( i >= 0 ) {
+            best = level.ids[i];
+            bestDist2 = dist2;
+        }
+    }
+
+    for(int l = 0; l < (int) levels_.size(); l++) {
+        if( l == hintLevel ) continue;
+        const Level & level = levels_[l];
+        int i = level.tree.closest( _query, dist2, bestDist2, -1, levelStats );
+        if( i >= 0 ) {
+            best = level.ids[i];
+            bestDist2 = dist2;
+        }
+    }
+
+    if( _stats ) {
+        st.queries = 1;
+        *_stats += st;
+    }
+
+    _dist2 = ( best >= 0 ? bestDist2 : std::numeric_limits< double >::max() );
+    return best;
+}
+
+
+template <class T>
+void
+IncrementalKdTree3<T>::
+closestPerLabel(
+    const Vector3d & _query,
+    std::vector< int > & _ids,
+    std::vector< double > & _dist2,
+    double _maxDist2,
+    SearchStats * _stats
+) const
+{
+    _ids.assign( numLabels_, -1 );
+    _dist2.assign( numLabels_, _maxDist2 );
+    if( numLabels_ == 0 ) return;
+
+    // each level maps its points to ids itself, so the search runs in _ids
+    // and _dist2 and allocates nothing once they have their size
+    SearchStats st;
+    for(int l = 0; l < (int) levels_.size(); l++) {
+        const Level & level = levels_[l];
+        if( level.ids.empty() ) continue;
+        level.tree.closestPerLabel( _query, numLabels_, &_ids[0], &_dist2[0], &level.ids[0],
+                                    _stats ? &st : NULL );
+    }
+    if( _stats ) {
+        st.queries = 1;
+        *_stats += st;
+    }
+
+    for(int k = 0; k < numLabels_; k++)
+        if( _ids[k] < 0 ) _dist2[k] = std::numeric_limits< double >::max();
+}
+
+
+//=============================================================================
+#endif /* INCREMENTALKDTREE3_HH_ */
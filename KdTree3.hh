@@ -0,0 +1,594 @@
+//=============================================================================
+//
+//   Code framework for the lecture
+//
+//   "Surface Representation and Geometric Modeling"
+//
+//   Mark Pauly, Mario Botsch, Balint Miklos, and Hao Li
+//
+//   Copyright (C) 2007 by  Applied Geometry Group and
+//                          Computer Graphics Laboratory, ETH Zurich
+//
+//-----------------------------------------------------------------------------
+//
+//                                License
+//
+//   This program is free software; you can redistribute it and/or
+//   modify it under the terms of the GNU General Public License
+//   as published by the Free Software Foundation; either version 2
+//   of the License, or (at your option) any later version.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program; if not, write to the Free Software
+//   Foundation, Inc., 51 Franklin Street, Fifth Floor,
+//   Boston, MA  02110-1301, USA.
+//
+//=============================================================================
+//=============================================================================
+//
+//  CLASS KdTree3
+//
+//=============================================================================
+
+
+#ifndef KDTREE3_HH_
+#define KDTREE3_HH_
+
+#include <vector>
+#include <limits>
+#include <algorithm>
+#include "Vector.hh"
+#include "SearchStats.hh"
+
+/**
+ * KdTree3 class
+ *
+ * kd-tree for closest point queries in 3D, with the coordinates stored as T
+ * (float or double). Unlike the general ANN trees the dimension is fixed at
+ * compile time, so the distance computations are unrolled, and with
+ * T = float the tree and its points take half the memory.
+ *
+ * The tree is balanced (split at the median of the widest extent) and stored
+ * in one array in depth-first order: the low child of a node directly
+ * follows it, the node stores the index of its high child. The points are
+ * copied into leaf order, so a leaf is one contiguous run of points.
+ */
+template <class T>
+class KdTree3
+{
+public:
+    /// point type used for storage
+    typedef Vector<T,3> Point;
+
+    /// constructor: empty tree, exact search
+    KdTree3() : maxErr_(1), maxPtsVisited_(0) {}
+
+    /// build tree for _pts with at most _bucketSize points per leaf
+    void build(const std::vector< Vector3d > & _pts, int _bucketSize = 16);
+
+    /// release data
+    void clear();
+
+    /// number of points in the tree
+    int size() const { return (int) indices_.size(); }
+
+    /// make closest() approximate: the result may be up to a factor 1+_eps
+    /// further away than the closest point, and a search stops descending
+    /// after visiting _maxPtsVisited points (0 = no limit). (0, 0) is exact
+    void setApproximation(double _eps, int _maxPtsVisited = 0)
+    {
+        maxErr_ = (T) ((1 + _eps) * (1 + _eps));
+        maxPtsVisited_ = _maxPtsVisited;
+    }
+
+    /// retrieve index of closest point of _query and its squared distance,
+    /// considering only points closer than sqrt(_maxDist2) (-1 if there is
+    /// none); cells further away than that are not visited. The search
+    /// starts in the leaf of point _hint (if valid), and skips the tree when
+    /// the result must be in that leaf, which is cheap when the hint is close
+    /// to the result. The query is counted in _stats, if given
+    int closest(const Vector3d & _query, double & _dist2,
+                double _maxDist2 = std::numeric_limits< double >::max(),
+                int _hint = -1, SearchStats * _stats = NULL) const;
+
+    /// label the points for closestPerLabel(), point i gets label
+    /// _labels[i] >= 0. Labels up to 63 have a bit of their own in the masks
+    /// of the labels below each node, larger ones share the last bit
+    void setLabels(const std::vector< int > & _labels);
+
+    /// retrieve the closest point of _query for every label in
+    /// [0, _numLabels) (see setLabels()). On input _dist2[l] bounds the
+    /// search for label l like _maxDist2 in closest(); where a closer point
+    /// is found, _index[l] and _dist2[l] are replaced by it. All labels are
+    /// served by one traversal, which skips a cell unless one of the labels
+    /// below it has its bound further away than the cell. If _ids is given,
+    /// point i is reported as _ids[i]. The search works in the given arrays
+    /// and allocates nothing. The query is counted in _stats, if given
+    void closestPerLabel(const Vector3d & _query, int _numLabels,
+                         int * _index, double * _dist2, const int * _ids = NULL,
+                         SearchStats * _stats = NULL) const;
+
+private:
+    /// node: leaves have cutDim = ~(number of points) and link = first point,
+    /// splitting nodes have link = index of the high child
+    struct Node {
+        T   cutVal;
+        int cutDim;
+        int link;
+    };
+
+    /// orders point indices by one coordinate
+    struct CoordLess {
+        const std::vector< Point > & pts;
+        int dim;
+        CoordLess(const std::vector< Point > & _pts, int _dim) : pts(_pts), dim(_dim) {}
+        bool operator()(int a, int b) const { return pts[a][dim] < pts[b][dim]; }
+    };
+
+    /// recursively build the subtree for indices_[_first.._first+_n-1],
+    /// whose cell is the box [_cellLo, _cellHi]
+    void buildNode(int _first, int _n, int _bucketSize, const std::vector< Point > & _pts,
+                   Point _cellLo, Point _cellHi);
+
+    /// recursively search the subtree at _node, _off holds the offsets of the
+    /// query from the node's cell per coordinate, _rd their squared length,
+    /// _st counts what this query visited (its points for the limit)
+    void searchNode(int _node, const T * _q, T * _off, T _rd, int & _best, T & _bestDist2,
+                    SearchStats & _st) const;
+
+    /// as searchNode(), with the best point and distance per label, which
+    /// are stored as closestPerLabel() returns them
+    void searchNodePerLabel(int _node, const T * _q, T * _off, T _rd, int _numLabels,
+                            int * _index, double * _dist2, const int * _ids,
+                            SearchStats & _st) const;
+
+private:
+    /// nodes in depth-first order
+    std::vector< Node > nodes_;
+
+    /// points in leaf order
+    std::vector< Point > points_;
+
+    /// original index of each point in points_
+    std::vector< int > indices_;
+
+    /// position in points_ of each original point
+    std::vector< int > positions_;
+
+    /// leaf containing each position in points_, as index into cells_
+    std::vector< int > leafOf_;
+
+    /// cell and points of each leaf (in leaf order); outer faces are at
+    /// infinity
+    struct Cell {
+        Point lo, hi;
+        int   first, n;
+    };
+    std::vector< Cell > cells_;
+
+    /// label of each position in points_ and mask of the labels below each
+    /// node (empty without setLabels())
+    std::vector< int >                  labels_;
+    std::vector< unsigned long long >   labelMasks_;
+
+    /// bounding box of the points
+    Point lo_, hi_;
+
+    /// squared error factor (1+eps)^2 and limit on points visited
+    T   maxErr_;
+    int maxPtsVisited_;
+};
+
+
+//=============================================================================
+
+
+template <class T>
+void
+KdTree3<T>::
+clear()
+{
+    std::vector< Node >().swap( nodes_ );
+    std::vector< Point >().swap( points_ );
+    std::vector< int >().swap( indices_ );
+    std::vector< int >().swap( positions_ );
+    std::vector< int >().swap( leafOf_ );
+    std::vector< Cell >().swap( cells_ );
+    std::vector< int >().swap( labels_ );
+    std::vector< unsigned long long >().swap( labelMasks_ );
+}
+
+
+template <class T>
+void
+KdTree3<T>::
+build(
+    const std::vector< Vector3d > & _pts,
+    int _bucketSize
+)
+{
+    clear();
+
+    int n = (int) _pts.size();
+    if( n == 0 ) return;
+    if( _bucketSize < 1 ) _bucketSize = 1;
+
+    // convert points to storage type
+    std::vector< Point > pts( n );
+    for(int i = 0; i < n; i++) {
+        pts[i][0] = (T) _pts[i][0];
+        pts[i][1] = (T) _pts[i][1];
+        pts[i][2] = (T) _pts[i][2];
+    }
+
+    indices_.resize( n );
+    for(int i = 0; i < n; i++) indices_[i] = i;
+
+    lo_ = hi_ = pts[0];
+    for(int i = 1; i < n; i++) {
+        for(int d = 0; d < 3; d++) {
+            if( pts[i][d] < lo_[d] ) lo_[d] = pts[i][d];
+            if( pts[i][d] > hi_[d] ) hi_[d] = pts[i][d];
+        }
+    }
+
+    nodes_.reserve( 2 * (n / _bucketSize) + 1 );
+    Point cellLo, cellHi;
+    for(int d = 0; d < 3; d++) {
+        cellLo[d] = -std::numeric_limits< T >::max();
+        cellHi[d] = std::numeric_limits< T >::max();
+    }
+    buildNode( 0, n, _bucketSize, pts, cellLo, cellHi );
+
+    // copy points in leaf order
+    points_.resize( n );
+    positions_.resize( n );
+    for(int i = 0; i < n; i++) {
+        points_[i] = pts[ indices_[i] ];
+        positions_[ indices_[i] ] = i;
+    }
+    leafOf_.resize( n );
+    for(int l = 0; l < (int) cells_.size(); l++) {
+        for(int i = cells_[l].first; i < cells_[l].first + cells_[l].n; i++)
+            leafOf_[i] = l;
+    }
+}
+
+
+template <class T>
+void
+KdTree3<T>::
+buildNode(
+    int _first,
+    int _n,
+    int _bucketSize,
+    const std::vector< Point > & _pts,
+    Point _cellLo,
+    Point _cellHi
+)
+{
+    int node = (int) nodes_.size();
+    nodes_.push_back( Node() );
+
+    if( _n <= _bucketSize ) {
+        nodes_[node].cutVal = 0;
+        nodes_[node].cutDim = ~_n;
+        nodes_[node].link = _first;
+
+        Cell cell;
+        cell.lo = _cellLo;
+        cell.hi = _cellHi;
+        cell.first = _first;
+        cell.n = _n;
+        cells_.push_back( cell );
+        return;
+    }
+
+    // split the widest extent of the points' bounding box
+    Point lo = _pts[ indices_[_first] ], hi = lo;
+    for(int i = _first + 1; i < _first + _n; i++) {
+        const Point & p = _pts[ indices_[i] ];
+        for(int d = 0; d < 3; d++) {
+            if( p[d] < lo[d] ) lo[d] = p[d];
+            if( p[d] > hi[d] ) hi[d] = p[d];
+        }
+    }
+    int cutDim = 0;
+    for(int d = 1; d < 3; d++) {
+        if( hi[d] - lo[d] > hi[cutDim] - lo[cutDim] ) cutDim = d;
+    }
+
+    // at the median, so that the tree is balanced
+    int half = _n / 2;
+    std::vector< int >::iterator first = indices_.begin() + _first;
+    std::nth_element( first, first + half, first + _n, CoordLess( _pts, cutDim ) );
+    T cutVal = _pts[ indices_[_first + half] ][cutDim];
+
+    Point cellHi = _cellHi, cellLo = _cellLo;
+    cellHi[cutDim] = cutVal;
+    cellLo[cutDim] = cutVal;
+
+    buildNode( _first, half, _bucketSize, _pts, _cellLo, cellHi );
+    int high = (int) nodes_.size();
+    buildNode( _first + half, _n - half, _bucketSize, _pts, cellLo, _cellHi );
+
+    nodes_[node].cutVal = cutVal;
+    nodes_[node].cutDim = cutDim;
+    nodes_[node].link = high;
+}
+
+
+template <class T>
+int
+KdTree3<T>::
+closest(
+    const Vector3d & _query,
+    double & _dist2,
+    double _maxDist2,
+    int _hint,
+    SearchStats * _stats
+) const
+{
+    _dist2 = std::numeric_limits< double >::max();
+    if( nodes_.empty() ) return -1;
+
+    SearchStats st;
+    st.queries = 1;
+
+    T q[3] = { (T) _query[0], (T) _query[1], (T) _query[2] };
+    int best = -1;
+    T bestDist2 = std::numeric_limits< T >::max();
+    if( _maxDist2 < (double) bestDist2 ) bestDist2 = (T) _maxDist2;
+
+    // with a hint, first search the leaf containing it. If the ball around
+    // the query with radius of the best distance found there lies inside
+    // the leaf's cell, no other leaf can hold a closer point and the tree
+    // need not be searched at all
+    if( _hint >= 0 && _hint < size() ) {
+        const Cell & cell = cells_[ leafOf_[ positions_[_hint] ] ];
+        st.leaves++;
+        st.points += cell.n;
+        for(int i = cell.first; i < cell.first + cell.n; i++) {
+            T dx = q[0] - points_[i][0];
+            T dy = q[1] - points_[i][1];
+            T dz = q[2] - points_[i][2];
+            T dist2 = dx*dx + dy*dy + dz*dz;
+            if( dist2 < bestDist2 ) {
+                bestDist2 = dist2;
+                best = i;
+            }
+        }
+
+        bool inside = true;
+        for(int d = 0; d < 3 && inside; d++) {
+            T toLo = q[d] - cell.lo[d];
+            T toHi = cell.hi[d] - q[d];
+            inside = ( toLo >= 0 && toHi >= 0 &&
+                       toLo*toLo >= bestDist2 && toHi*toHi >= bestDist2 );
+        }
+        if( best >= 0 ) st.leafHits++;
+        if( inside ) {
+            st.hintExits++;
+            if( _stats ) *_stats += st;
+            if( best < 0 ) return -1;
+            _dist2 = bestDist2;
+            return indices_[best];
+        }
+    }
+
+    // start with the offsets from the bounding box, so that a query further
+    // away than the bound ends here
+    T off[3], rd = 0;
+    for(int d = 0; d < 3; d++) {
+        off[d] = ( q[d] < lo_[d] ) ? q[d] - lo_[d] : ( q[d] > hi_[d] ) ? q[d] - hi_[d] : 0;
+        rd += off[d]*off[d];
+    }
+    if( rd * maxErr_ < bestDist2 )
+        searchNode( 0, q, off, rd, best, bestDist2, st );
+
+    if( _stats ) {
+        if( maxPtsVisited_ != 0 && st.points > maxPtsVisited_ ) st.earlyOuts++;
+        *_stats += st;
+    }
+    if( best < 0 ) return -1;
+    _dist2 = bestDist2;
+    return indices_[best];
+}
+
+
+template <class T>
+void
+KdTree3<T>::
+searchNode(
+    int _node,
+    const T * _q,
+    T * _off,
+    T _rd,
+    int & _best,
+    T & _bestDist2,
+    SearchStats & _st
+) const
+{
+    const Node & node = nodes_[_node];
+
+    if( node.cutDim < 0 ) {
+        const Point * p = &points_[ node.link ];
+        int n = ~node.cutDim;
+        int best = _best;
+        for(int i = 0; i < n; i++) {
+            T dx = _q[0] - p[i][0];
+            T dy = _q[1] - p[i][1];
+            T dz = _q[2] - p[i][2];
+            T dist2 = dx*dx + dy*dy + dz*dz;
+            if( dist2 < _bestDist2 ) {
+                _bestDist2 = dist2;
+                _best = node.link + i;
+            }
+        }
+        _st.leaves++;
+        _st.points += n;
+        _st.leafHits += ( _best != best );
+        return;
+    }
+
+    // out of budget
+    if( maxPtsVisited_ != 0 && _st.points > maxPtsVisited_ ) return;
+    _st.nodes++;
+
+    // visit the child containing the query first
+    int cutDim = node.cutDim;
+    T diff = _q[cutDim] - node.cutVal;
+    int nearChild = ( diff < 0 ) ? _node + 1 : node.link;
+    int farChild  = ( diff < 0 ) ? node.link : _node + 1;
+
+    searchNode( nearChild, _q, _off, _rd, _best, _bestDist2, _st );
+
+    // then the other one, if its cell is closer than the best point so far
+    // (by more than the error factor)
+    T oldOff = _off[cutDim];
+    T rd = _rd - oldOff*oldOff + diff*diff;
+    if( rd * maxErr_ < _bestDist2 ) {
+        _off[cutDim] = diff;
+        searchNode( farChild, _q, _off, rd, _best, _bestDist2, _st );
+        _off[cutDim] = oldOff;
+    }
+}
+
+
+template <class T>
+void
+KdTree3<T>::
+setLabels(const std::vector< int > & _labels)
+{
+    int n = size();
+    labels_.resize( n );
+    for(int i = 0; i < n; i++)
+        labels_[i] = _labels[ indices_[i] ];
+
+    // children follow their parent, so going backwards they are done first
+    labelMasks_.assign( nodes_.size(), 0 );
+    for(int k = (int) nodes_.size() - 1; k >= 0; k--) {
+        const Node & node = nodes_[k];
+        if( node.cutDim < 0 ) {
+            for(int i = node.link; i < node.link + ~node.cutDim; i++)
+                labelMasks_[k] |= 1ull << std::min( labels_[i], 63 );
+        }
+        else
+            labelMasks_[k] = labelMasks_[k + 1] | labelMasks_[node.link];
+    }
+}
+
+
+template <class T>
+void
+KdTree3<T>::
+closestPerLabel(
+    const Vector3d & _query,
+    int _numLabels,
+    int * _index,
+    double * _dist2,
+    const int * _ids,
+    SearchStats * _stats
+) const
+{
+    if( labelMasks_.empty() || _numLabels <= 0 ) return;
+
+    T q[3] = { (T) _query[0], (T) _query[1], (T) _query[2] };
+
+    T off[3], rd = 0;
+    for(int d = 0; d < 3; d++) {
+        off[d] = ( q[d] < lo_[d] ) ? q[d] - lo_[d] : ( q[d] > hi_[d] ) ? q[d] - hi_[d] : 0;
+        rd += off[d]*off[d];
+    }
+    SearchStats st;
+    st.queries = 1;
+    searchNodePerLabel( 0, q, off, rd, _numLabels, _index, _dist2, _ids, st );
+    if( _stats ) {
+        if( maxPtsVisited_ != 0 && st.points > maxPtsVisited_ ) st.earlyOuts++;
+        *_stats += st;
+    }
+}
+
+
+template <class T>
+void
+KdTree3<T>::
+searchNodePerLabel(
+    int _node,
+    const T * _q,
+    T * _off,
+    T _rd,
+    int _numLabels,
+    int * _index,
+    double * _dist2,
+    const int * _ids,
+    SearchStats & _st
+) const
+{
+    // skip the cell unless it is closer than the best point so far (by more
+    // than the error factor) for one of the labels below it
+    T rd = _rd * maxErr_;
+    bool open = false;
+    unsigned long long mask = labelMasks_[_node];
+    for(int l = 0; mask != 0 && !open; l++, mask >>= 1) {
+        if( !( mask & 1 ) ) continue;
+        if( l < 63 )
+            open = ( l < _numLabels && rd < _dist2[l] );
+        else
+            for(int m = 63; m < _numLabels && !open; m++)
+                open = ( rd < _dist2[m] );
+    }
+    if( !open ) return;
+
+    const Node & node = nodes_[_node];
+
+    if( node.cutDim < 0 ) {
+        const Point * p = &points_[ node.link ];
+        int n = ~node.cutDim;
+        bool hit = false;
+        for(int i = 0; i < n; i++) {
+            int l = labels_[ node.link + i ];
+            if( l >= _numLabels ) continue;
+            T dx = _q[0] - p[i][0];
+            T dy = _q[1] - p[i][1];
+            T dz = _q[2] - p[i][2];
+            T dist2 = dx*dx + dy*dy + dz*dz;
+            if( dist2 < _dist2[l] ) {
+                int index = indices_[ node.link + i ];
+                _dist2[l] = dist2;
+                _index[l] = _ids ? _ids[index] : index;
+                hit = true;
+            }
+        }
+        _st.leaves++;
+        _st.points += n;
+        _st.leafHits += hit;
+        return;
+    }
+
+    // out of budget
+    if( maxPtsVisited_ != 0 && _st.points > maxPtsVisited_ ) return;
+    _st.nodes++;
+
+    int cutDim = node.cutDim;
+    T diff = _q[cutDim] - node.cutVal;
+    int nearChild = ( diff < 0 ) ? _node + 1 : node.link;
+    int farChild  = ( diff < 0 ) ? node.link : _node + 1;
+
+    searchNodePerLabel( nearChild, _q, _off, _rd, _numLabels, _index, _dist2, _ids, _st );
+
+    T oldOff = _off[cutDim];
+    _off[cutDim] = diff;
+    searchNodePerLabel( farChild, _q, _off, _rd - oldOff*oldOff + diff*diff, _numLabels,
+                        _index, _dist2, _ids, _st );
+    _off[cutDim] = oldOff;
+}
+
+
+//=============================================================================
+#endif /* KDTREE3_HH_ */
@@ -36,79 +36,676 @@
 //=============================================================================
 
 #include <cstdio>
-#include <cstring>
+#include <algorithm>
 
 #include "Registration.hh"
 #include <math.h>
 
 using namespace std;
 
+//=============================================================================
+// Normal equations
+//
+// Every correspondence adds to the 21 entries of the upper triangle of AtA
+// and the 6 entries of Atb, NUM_SUMS sums in all.  The correspondences are
+// cut into at most MAX_BLOCKS blocks of at least MIN_BLOCK, which depend
+// only on their number, and the blocks are summed in parallel.  Within a
+// block they are copied CHUNK at a time into arrays of coordinates
+// (structure of arrays), which the kernels walk LANES at a time, adding
+// into LANES independent partial sums so that they vectorize.  The lanes,
+// and then the blocks, are added pairwise in a fixed order, so the result
+// does not depend on the number of threads.
+//
+// The points are moved by the current estimate of the transformation as
+// they are copied, and every correspondence is weighted by the robust
+// kernel of its residual there, so that the reweighted solves of a call
+// need no copy of the points.
+
+static const int NUM_SUMS   = 27;   // upper triangle of AtA and Atb
+static const int LANES      = 4;    // partial sums per block
+static const int CHUNK      = 256;  // correspondences copied at a time
+static const int MIN_BLOCK  = 4096; // fewest correspondences per block
+static const int MAX_BLOCKS = 64;   // most blocks
+
+typedef double LaneSums[NUM_SUMS][LANES];
+
+// current estimate and robust kernel, applied as the points are copied
+struct Reweighting
+{
+    double R[3][3], T[3];               // current transformation
+    Registration::RobustKernel kernel;  // robust kernel
+    double scale;                       // its scale
+
+    Reweighting( const Transformation & _tr, Registration::RobustKernel _kernel, double _scale )
+        : kernel(_kernel), scale(_scale)
+    {
+        for(int i = 0; i < 3; i++) {
+            for(int j = 0; j < 3; j++)
+                R[i][j] = _tr.rotation_[i][j];
+            T[i] = _tr.translation_[i];
+        }
+    }
+
+    // _p moved by the current transformation
+    void move( const Vector3d & _p, double _q[3] ) const
+    {
+        for(int i = 0; i < 3; i++)
+            _q[i] = R[i][0] * _p[0] + R[i][1] * _p[1] + R[i][2] * _p[2] + T[i];
+    }
+
+    // _v turned by the current rotation
+    void turn( const Vector3d & _v, double _u[3] ) const
+    {
+        for(int i = 0; i < 3; i++)
+            _u[i] = R[i][0] * _v[0] + R[i][1] * _v[1] + R[i][2] * _v[2];
+    }
+
+    // weight of residual _r
+    double weight( double _r ) const
+    {
+        double u2 = _r * _r / (scale * scale);
+        switch( kernel )
+        {
+            case Registration::HUBER:         return u2 <= 1 ? 1 : 1 / sqrt(u2);
+            case Registration::TUKEY:         return u2 < 1 ? (1 - u2) * (1 - u2) : 0;
+            case Registration::CAUCHY:        return 1 / (1 + u2);
+            case Registration::GEMAN_MCCLURE: return 1 / ((1 + u2) * (1 + u2));
+            default:                          return 1;
+        }
+    }
+};
+
+// index of AtA[i][j] (j >= i) in the sums; Atb[i] is at 21 + i
+static inline int upper( int i, int j )
+{
+    return i * 6 - i * (i - 1) / 2 + (j - i);
+}
+
+// add the lanes of each sum pairwise to the sums
+static void add_lanes( const LaneSums & _acc, double _sums[NUM_SUMS] )
+{
+    for(int k = 0; k < NUM_SUMS; k++)
+        _sums[k] += (_acc[k][0] + _acc[k][1]) + (_acc[k][2] + _acc[k][3]);
+}
+
+// point-2-point kernel: _m (a multiple of LANES) sources s, differences
+// d = target - src and weights w
+static void point2point_kernel( const double _s[3][CHUNK], const double _d[3][CHUNK], const double _w[CHUNK],
+                                int _m, LaneSums & _acc )
+{
+    for(int c = 0; c < _m; c += LANES)
+    {
+        for(int l = 0; l < LANES; l++)
+        {
+            const double sx = _s[0][c+l], sy = _s[1][c+l], sz = _s[2][c+l];
+            const double dx = _d[0][c+l], dy = _d[1][c+l], dz = _d[2][c+l];
+            const double w = _w[c+l];
+            const double wx = w*sx, wy = w*sy, wz = w*sz;
+
+            // rotation block: w (|s|^2 I - s s^T)
+            _acc[upper(0,0)][l] += wy*sy + wz*sz;
+            _acc[upper(0,1)][l] -= wx*sy;
+            _acc[upper(0,2)][l] -= wx*sz;
+            _acc[upper(1,1)][l] += wx*sx + wz*sz;
+            _acc[upper(1,2)][l] -= wy*sz;
+            _acc[upper(2,2)][l] += wx*sx + wy*sy;
+
+            // rotation-translation block: w [s]x
+            _acc[upper(0,4)][l] -= wz;
+            _acc[upper(0,5)][l] += wy;
+            _acc[upper(1,3)][l] += wz;
+            _acc[upper(1,5)][l] -= wx;
+            _acc[upper(2,3)][l] -= wy;
+            _acc[upper(2,4)][l] += wx;
+
+            // translation block: w I
+            _acc[upper(3,3)][l] += w;
+            _acc[upper(4,4)][l] += w;
+            _acc[upper(5,5)][l] += w;
+
+            // Atb = w ( s x d, d )
+            _acc[21][l] += wy*dz - wz*dy;
+            _acc[22][l] += wz*dx - wx*dz;
+            _acc[23][l] += wx*dy - wy*dx;
+            _acc[24][l] += w*dx;
+            _acc[25][l] += w*dy;
+            _acc[26][l] += w*dz;
+        }
+    }
+}
+
+// kernel for _m (a multiple of LANES) single rows a x = b
+static void row_kernel( const double _a[6][CHUNK], const double _b[CHUNK], int _m, LaneSums & _acc )
+{
+    for(int c = 0; c < _m; c += LANES)
+    {
+        int k = 0;
+        for(int i = 0; i < 6; i++)
+            for(int j = i; j < 6; j++, k++)
+                for(int l = 0; l < LANES; l++)
+                    _acc[k][l] += _a[i][c+l] * _a[j][c+l];
+
+        for(int i = 0; i < 6; i++)
+            for(int l = 0; l < LANES; l++)
+                _acc[21+i][l] += _a[i][c+l] * _b[c+l];
+    }
+}
+
+// sums of the point-2-point correspondences [_begin, _end)
+static void point2point_block( const Vector3d * _src, const Vector3d * _target, const Reweighting & _rw,
+                               int _begin, int _end, double _sums[NUM_SUMS] )
+{
+    double s[3][CHUNK], d[3][CHUNK], w[CHUNK];
+    LaneSums acc = {};
+
+    for(int first = _begin; first < _end; first += CHUNK)
+    {
+        int n = min(CHUNK, _end - first);
+        for(int i = 0; i < n; i++) {
+            double p[3];
+            _rw.move( _src[first+i], p );
+            for(int k = 0; k < 3; k++) {
+                s[k][i] = p[k];
+                d[k][i] = _target[first+i][k] - p[k];
+            }
+            w[i] = _rw.weight( sqrt(d[0][i] * d[0][i] + d[1][i] * d[1][i] + d[2][i] * d[2][i]) );
+        }
+
+        // pad to whole lanes with correspondences that add nothing
+        int m = (n + LANES - 1) / LANES * LANES;
+        for(int i = n; i < m; i++) {
+            for(int k = 0; k < 3; k++)
+                s[k][i] = d[k][i] = 0;
+            w[i] = 0;
+        }
+
+        point2point_kernel(s, d, w, m, acc);
+    }
+
+    add_lanes(acc, _sums);
+}
+
+// pad the _n rows a x = b to whole lanes with rows that add nothing, and
+// add them to _acc
+static void add_rows( double _a[6][CHUNK], double _b[CHUNK], int _n, LaneSums & _acc )
+{
+    int m = (_n + LANES - 1) / LANES * LANES;
+    for(int i = _n; i < m; i++) {
+        for(int k = 0; k < 6; k++)
+            _a[k][i] = 0;
+        _b[i] = 0;
+    }
+
+    row_kernel(_a, _b, m, _acc);
+}
+
+// sums of the point-2-surface correspondences [_begin, _end); with source
+// normals, of the symmetric ones, whose normal is the normalized sum of the
+// turned source normal and the target normal
+static void point2surface_block( const Vector3d * _src, const Vector3d * _srcNormals,
+                                 const Vector3d * _target, const Vector3d * _normals,
+                                 const Reweighting & _rw, int _begin, int _end, double _sums[NUM_SUMS] )
+{
+    double a[6][CHUNK], b[CHUNK];
+    LaneSums acc = {};
+
+    for(int first = _begin; first < _end; first += CHUNK)
+    {
+        int n = min(CHUNK, _end - first);
+        for(int i = 0; i < n; i++) {
+            double s[3], nt[3];
+            _rw.move( _src[first+i], s );
+            for(int k = 0; k < 3; k++)
+                nt[k] = _normals[first+i][k];
+            if( _srcNormals ) {
+                // normalized, so that the residual and its weight are on
+                // the scale of point-2-surface (opposite normals give a
+                // zero row, which adds nothing)
+                double ns[3], l = 0;
+                _rw.turn( _srcNormals[first+i], ns );
+                for(int k = 0; k < 3; k++) {
+                    nt[k] += ns[k];
+                    l += nt[k] * nt[k];
+                }
+                l = l > 0 ? 1 / sqrt(l) : 0;
+                for(int k = 0; k < 3; k++)
+                    nt[k] *= l;
+            }
+            const Vector3d & t = _target[first+i];
+
+            // the row [ (src x n)^T  n^T ] x = n . (target - src), scaled
+            // by the square root of its weight
+            double r = nt[0] * (t[0] - s[0]) + nt[1] * (t[1] - s[1]) + nt[2] * (t[2] - s[2]);
+            double sw = sqrt( _rw.weight( r ) );
+            a[0][i] = sw * (nt[2] * s[1] - nt[1] * s[2]);
+            a[1][i] = sw * (nt[0] * s[2] - nt[2] * s[0]);
+            a[2][i] = sw * (nt[1] * s[0] - nt[0] * s[1]);
+            a[3][i] = sw * nt[0];
+            a[4][i] = sw * nt[1];
+            a[5][i] = sw * nt[2];
+            b[i] = sw * r;
+        }
+
+        add_rows(a, b, n, acc);
+    }
+
+    add_lanes(acc, _sums);
+}
+
+// sums of the plane-2-plane correspondences [_begin, _end)
+//
+// Every point is taken as a sample of a plane, with the covariance
+//   C(n) = I - (1 - PLANE_EPS) n n^T
+// of its unit normal n: spread along the plane and thin across it.  A
+// correspondence with difference d = target - src weighs d by the inverse
+// of C = C(turned source normal) + C(target normal).  With the Cholesky
+// factor C = K K^T, it adds the three rows K^-1 J x = K^-1 d, where the
+// rows of J = [ -[src]x  I ] are those of point-2-point.
+static const double PLANE_EPS = 1e-3;
+
+static void plane2plane_block( const Vector3d * _src, const Vector3d * _srcNormals,
+                               const Vector3d * _target, const Vector3d * _normals,
+                               const Reweighting & _rw, int _begin, int _end, double _sums[NUM_SUMS] )
+{
+    double a[6][CHUNK], b[CHUNK];
+    LaneSums acc = {};
+    int n = 0;
+
+    for(int i = _begin; i < _end; i++)
+    {
+        double s[3], ns[3], nt[3], d[3];
+        _rw.move( _src[i], s );
+        _rw.turn( _srcNormals[i], ns );
+        double ls = 0, lt = 0;
+        for(int k = 0; k < 3; k++) {
+            nt[k] = _normals[i][k];
+            d[k] = _target[i][k] - s[k];
+            ls += ns[k] * ns[k];
+            lt += nt[k] * nt[k];
+        }
+        ls = ls > 0 ? 1 / sqrt(ls) : 0;
+        lt = lt > 0 ? 1 / sqrt(lt) : 0;
+        for(int k = 0; k < 3; k++) {
+            ns[k] *= ls;
+            nt[k] *= lt;
+        }
+
+        // combined covariance and its Cholesky factor K (lower triangle)
+        double K[3][3];
+        for(int j = 0; j < 3; j++)
+            for(int k = 0; k <= j; k++)
+                K[j][k] = (j == k ? 2 : 0) - (1 - PLANE_EPS) * (ns[j] * ns[k] + nt[j] * nt[k]);
+        for(int j = 0; j < 3; j++) {
+            for(int k = 0; k < j; k++) {
+                for(int l = 0; l < k; l++)
+                    K[j][k] -= K[j][l] * K[k][l];
+                K[j][k] /= K[k][k];
+            }
+            for(int l = 0; l < j; l++)
+                K[j][j] -= K[j][l] * K[j][l];
+            K[j][j] = sqrt(K[j][j]);
+        }
+
+        // J and d, solved for K^-1 J and K^-1 d by forward substitution;
+        // the weight is that of the distance to the target plane
+        double J[3][7] = {
+            {     0,  s[2], -s[1], 1, 0, 0, d[0] },
+            { -s[2],     0,  s[0], 0, 1, 0, d[1] },
+            {  s[1], -s[0],     0, 0, 0, 1, d[2] }
+        };
+        for(int j = 0; j < 3; j++) {
+            for(int l = 0; l < j; l++)
+                for(int c = 0; c < 7; c++)
+                    J[j][c] -= K[j][l] * J[l][c];
+            for(int c = 0; c < 7; c++)
+                J[j][c] /= K[j][j];
+        }
+
+        double sw = sqrt( _rw.weight( nt[0] * d[0] + nt[1] * d[1] + nt[2] * d[2] ) );
+        for(int j = 0; j < 3; j++, n++) {
+            for(int c = 0; c < 6; c++)
+                a[c][n] = sw * J[j][c];
+            b[n] = sw * J[j][6];
+        }
+
+        if( n + 3 > CHUNK ) {
+            add_rows(a, b, n, acc);
+            n = 0;
+        }
+    }
+
+    add_rows(a, b, n, acc);
+    add_lanes(acc, _sums);
+}
+
+// sum _n correspondences in blocks, _block(begin, end, sums) adds the sums
+// of the correspondences [begin, end)
+template <class Block>
+static void reduce_normal_equations( int _n, Block _block, double _AtA[6][6], double _Atb[6] )
+{
+    int numBlocks = max(1, min(MAX_BLOCKS, _n / MIN_BLOCK));
+    double partial[MAX_BLOCKS][NUM_SUMS] = {};
+
+#pragma omp parallel for schedule(static) if(numBlocks > 1)
+    for(int k = 0; k < numBlocks; k++)
+    {
+        int begin = (int) ((long long) _n * k / numBlocks);
+        int end = (int) ((long long) _n * (k + 1) / numBlocks);
+        _block(begin, end, partial[k]);
+    }
+
+    // add the blocks pairwise, in the same order for any number of threads
+    for(int step = 1; step < numBlocks; step *= 2)
+        for(int k = 0; k + step < numBlocks; k += 2 * step)
+            for(int s = 0; s < NUM_SUMS; s++)
+                partial[k][s] += partial[k+step][s];
+
+    // only the upper triangle of AtA is set, which is all CholeskySolve reads
+    for(int i = 0; i < 6; i++) {
+        for(int j = 0; j < 6; j++)
+            _AtA[i][j] = j >= i ? partial[0][upper(i,j)] : 0;
+        _Atb[i] = partial[0][21+i];
+    }
+}
+
+
+//=============================================================================
+
+// whether two estimates are (numerically) the same, which ends the
+// reweighted solves
+static bool small_change( const Transformation & _a, const Transformation & _b )
+{
+    double d = 0;
+    for(int i = 0; i < 3; i++) {
+        d = max(d, fabs(_a.translation_[i] - _b.translation_[i]));
+        for(int j = 0; j < 3; j++)
+            d = max(d, fabs(_a.rotation_[i][j] - _b.rotation_[i][j]));
+    }
+    return d < 1e-10;
+}
+
+
+// Gauss-Newton steps from the identity, _step(current) is the step from
+// the points moved by the current estimate; at most _iterations, until
+// the estimate no longer changes
+template <class Step>
+static Transformation gauss_newton( int _iterations, Step _step )
+{
+    Transformation tr;
+
+    for(int it = 0; it < _iterations; it++)
+    {
+        Transformation step = _step( tr );
+        Transformation next = step * tr;
+        next.orthonormalize();
+
+        bool converged = small_change( tr, next );
+        tr = next;
+        if( converged )
+            break;
+    }
+
+    return tr;
+}
+
+
+//=============================================================================
+
+// constructor: least squares, one solve per call
+Registration::Registration()
+    : kernel_(LEAST_SQUARES), scale_(1.0), iterations_(1)
+{
+}
+
+
+// set the robust kernel and its scale
+void Registration::set_robust_kernel( RobustKernel _kernel, double _scale )
+{
+    kernel_ = _kernel;
+    scale_ = _scale;
+}
+
+
+// set the most solves per call
+void Registration::set_iterations( int _iterations )
+{
+    iterations_ = max(1, _iterations);
+}
+
+
+// name of a robust kernel
+const char * Registration::kernelName( RobustKernel _kernel )
+{
+    switch( _kernel )
+    {
+        case HUBER:         return "Huber";
+        case TUKEY:         return "Tukey";
+        case CAUCHY:        return "Cauchy";
+        case GEMAN_MCCLURE: return "Geman-McClure";
+        default:            return "least squares";
+    }
+}
+
+
 //=============================================================================
 
 // point-2-point registration
 Transformation Registration::register_point2point(
     const std::vector< Vector3d > & _src,       // moving points (source)
-    const std::vector< Vector3d > & _target )   // target points  (target)
+    const std::vector< Vector3d > & _target,    // target points  (target)
+    Point2PointSolver _solver )                 // how to solve for R and T
 {
     // we minimise the following distance measure:
     // min e = sum(i=1.._n)(|| R src[i] + T - target[i] ||^2)
+    // or, with a robust kernel, the sum of its weighted residuals; the
+    // weights of a solve are those of the residuals after the last one
 
-    int numRows = _src.size() * 3;
-    double * A = new double[numRows * 6];
-    double * b = new double[numRows];
-    memset(A,0,sizeof(double)*numRows*6);
-    memset(b,0,sizeof(double)*numRows);
+    Transformation tr;
 
-    for(int i = 0; i < (int) _src.size(); i++)
+    for(int it = 0; it < iterations_; it++)
     {
-        // EXERCISE 2.4 /////////////////////////////////////////////////////////////
-        // point-2-point constraints
-        // set up matrix A and b with the linear constraints
+        Transformation next;
+        if( _solver == CLOSED_FORM )
+        {
+            next = register_point2point_closed_form( _src, _target, tr );
+        }
+        else
+        {
+            Transformation step = point2point_step( _src, _target, tr );
+            next = step * tr;
+            next.orthonormalize();
+        }
 
-        ////////////////////////////////////////////////////////////////////////////
+        bool converged = small_change( tr, next );
+        tr = next;
 
-        // A should only be about source points
-        A[i * 3 * 6 + 1] = _src[i].v[2];
-        A[i * 3 * 6 + 2] = -(_src[i].v[1]);
-        A[i * 3 * 6 + 3] = 1.00;
+        // without weights the closed form is exact at once
+        if( converged || ( _solver == CLOSED_FORM && kernel_ == LEAST_SQUARES ) )
+            break;
+    }
 
-        A[(i * 3 + 1) * 6] = -(_src[i].v[2]);
-        A[(i * 3 + 1) * 6 + 2] = _src[i].v[0];
-        A[(i * 3 + 1) * 6 + 4] = 1.00;
+    return tr;
+}
 
-        A[(i * 3 + 2) * 6] = _src[i].v[1];
-        A[(i * 3 + 2) * 6 + 1] = -(_src[i].v[0]);
-        A[(i * 3 + 2) * 6 + 5] = 1.00;
 
-        // b should be the distance between each target point and src point
-        b[i * 3] = _target[i].v[0] - _src[i].v[0];
-        b[i * 3 + 1] = _target[i].v[1] - _src[i].v[1];
-        b[i * 3 + 2] = _target[i].v[2] - _src[i].v[2];
+//=============================================================================
 
-        ////////////////////////////////////////////////////////////////////////////
+// one linearized point-2-point step from the points moved by _current
+Transformation Registration::point2point_step(
+    const std::vector< Vector3d > & _src,       // moving points (source)
+    const std::vector< Vector3d > & _target,    // target points  (target)
+    const Transformation & _current )           // current estimate
+{
+    // every correspondence adds the three rows
+    //   [  0   sz -sy  1 0 0 ]        [ dx ]
+    //   [ -sz  0   sx  0 1 0 ] x  =   [ dy ]
+    //   [  sy -sx  0   0 0 1 ]        [ dz ]
+    // with s the moved source and d = target - s, times its weight; their
+    // contribution to the normal equations is summed in closed form, so
+    // the rows themselves are never stored
+    const Vector3d * src = _src.data();
+    const Vector3d * target = _target.data();
+    const Reweighting rw( _current, kernel_, scale_ );
+    double AtA[6][6];
+    double Atb[6];
+
+    reduce_normal_equations( (int) _src.size(),
+        [=, &rw]( int _begin, int _end, double * _sums ) {
+            point2point_block( src, target, rw, _begin, _end, _sums );
+        }, AtA, Atb );
 
+    return SolveNormalEquations(AtA, Atb);
+}
+
+
+//=============================================================================
+
+// eigenvalues _d and eigenvectors (the columns of _V) of the symmetric 4x4
+// matrix _A, by cyclic Jacobi rotations; _A is overwritten
+static void jacobi_eigen4( double _A[4][4], double _V[4][4], double _d[4] )
+{
+    for(int i = 0; i < 4; i++)
+        for(int j = 0; j < 4; j++)
+            _V[i][j] = i == j ? 1 : 0;
+
+    for(int sweep = 0; sweep < 50; sweep++)
+    {
+        double diag = 0, off = 0;
+        for(int p = 0; p < 4; p++) {
+            diag += _A[p][p] * _A[p][p];
+            for(int q = p + 1; q < 4; q++)
+                off += _A[p][q] * _A[p][q];
+        }
+        if( off <= 1e-30 * diag || off == 0 )
+            break;
+
+        for(int p = 0; p < 3; p++)
+        {
+            for(int q = p + 1; q < 4; q++)
+            {
+                if( _A[p][q] == 0 )
+                    continue;
+
+                // rotate in the (p, q) plane so that A[p][q] becomes zero
+                double theta = (_A[q][q] - _A[p][p]) / (2 * _A[p][q]);
+                double t = (theta >= 0 ? 1 : -1) / (fabs(theta) + sqrt(theta * theta + 1));
+                double c = 1 / sqrt(t * t + 1);
+                double s = t * c;
+
+                for(int k = 0; k < 4; k++) {
+                    double akp = _A[k][p], akq = _A[k][q];
+                    _A[k][p] = c * akp - s * akq;
+                    _A[k][q] = s * akp + c * akq;
+                }
+                for(int k = 0; k < 4; k++) {
+                    double apk = _A[p][k], aqk = _A[q][k];
+                    _A[p][k] = c * apk - s * aqk;
+                    _A[q][k] = s * apk + c * aqk;
+                }
+                for(int k = 0; k < 4; k++) {
+                    double vkp = _V[k][p], vkq = _V[k][q];
+                    _V[k][p] = c * vkp - s * vkq;
+                    _V[k][q] = s * vkp + c * vkq;
+                }
+            }
+        }
     }
 
-    // solve overdetermined Ax=b
-    double x[6];
+    for(int i = 0; i < 4; i++)
+        _d[i] = _A[i][i];
+}
 
+
+//=============================================================================
+
+// closed form point-2-point registration (Horn, "Closed-form solution of
+// absolute orientation using unit quaternions", 1987)
+Transformation Registration::register_point2point_closed_form(
+    const std::vector< Vector3d > & _src,       // moving points (source)
+    const std::vector< Vector3d > & _target,    // target points  (target)
+    const Transformation & _current )           // estimate for the weights
+{
+    int n = (int) _src.size();
     Transformation tr;
 
-    if( Solve(A,b,x,numRows) )
+    if( n == 0 )
     {
-        // get the transformation from the rotation angles and translation vector
-        tr.rotation_ = GetRotation( x[0], x[1], x[2] );
-        tr.translation_[0] = x[3];
-        tr.translation_[1] = x[4];
-        tr.translation_[2] = x[5];
+        printf("Registration::register_point2point() => no correspondences\n");
+        return tr;
     }
-    else
+
+    // one pass over the correspondences for the weighted sums of the
+    // points and of their products, taken relative to the first pair so
+    // that the centered cross-covariance does not cancel for points far
+    // from the origin; the weights are those of the residuals under the
+    // current estimate
+    const Reweighting rw( _current, kernel_, scale_ );
+    const Vector3d s0 = _src[0], t0 = _target[0];
+    double sumW = 0, sumS[3] = { 0, 0, 0 }, sumT[3] = { 0, 0, 0 };
+    double sumST[3][3] = { { 0, 0, 0 }, { 0, 0, 0 }, { 0, 0, 0 } };
+
+    for(int i = 0; i < n; i++)
     {
-        printf("Registration::ComputeTransformation() => Cholesky failed\n");
+        double w = 1;
+        if( kernel_ != LEAST_SQUARES ) {
+            double p[3];
+            rw.move( _src[i], p );
+            w = rw.weight( sqrt( (p[0] - _target[i][0]) * (p[0] - _target[i][0]) +
+                                 (p[1] - _target[i][1]) * (p[1] - _target[i][1]) +
+                                 (p[2] - _target[i][2]) * (p[2] - _target[i][2]) ) );
+        }
+
+        const double s[3] = { _src[i][0] - s0[0], _src[i][1] - s0[1], _src[i][2] - s0[2] };
+        const double t[3] = { _target[i][0] - t0[0], _target[i][1] - t0[1], _target[i][2] - t0[2] };
+
+        sumW += w;
+        for(int j = 0; j < 3; j++) {
+            sumS[j] += w * s[j];
+            sumT[j] += w * t[j];
+            for(int k = 0; k < 3; k++)
+                sumST[j][k] += w * s[j] * t[k];
+        }
+    }
+
+    if( sumW == 0 )
+    {
+        printf("Registration::register_point2point() => all correspondences rejected\n");
+        return _current;
     }
 
-    if(A) delete [] A;
-    if(b) delete [] b;
+    // cross-covariance S = sum w (src - mean src) (target - mean target)^T
+    double S[3][3];
+    for(int j = 0; j < 3; j++)
+        for(int k = 0; k < 3; k++)
+            S[j][k] = sumST[j][k] - sumS[j] * sumT[k] / sumW;
+
+    // the rotation is the unit quaternion (w, x, y, z) which is the
+    // eigenvector of the largest eigenvalue of N
+    double N[4][4] = {
+        { S[0][0] + S[1][1] + S[2][2], S[1][2] - S[2][1],            S[2][0] - S[0][2],            S[0][1] - S[1][0]           },
+        { S[1][2] - S[2][1],           S[0][0] - S[1][1] - S[2][2],  S[0][1] + S[1][0],            S[2][0] + S[0][2]           },
+        { S[2][0] - S[0][2],           S[0][1] + S[1][0],           -S[0][0] + S[1][1] - S[2][2],  S[1][2] + S[2][1]           },
+        { S[0][1] - S[1][0],           S[2][0] + S[0][2],            S[1][2] + S[2][1],           -S[0][0] - S[1][1] + S[2][2] }
+    };
+    double V[4][4], d[4];
+    jacobi_eigen4( N, V, d );
+
+    int best = 0;
+    for(int i = 1; i < 4; i++)
+        if( d[i] > d[best] ) best = i;
+
+    double q[4];
+    for(int i = 0; i < 4; i++)
+        q[i] = V[i][best];
+
+    // T = mean target - R mean src
+    tr = Transformation( q, Vector3d( 0, 0, 0 ) );
+    Vector3d meanS, meanT;
+    for(int j = 0; j < 3; j++) {
+        meanS[j] = s0[j] + sumS[j] / sumW;
+        meanT[j] = t0[j] + sumT[j] / sumW;
+    }
+    tr.translation_ = meanT - tr.rotation_ * meanS;
 
     return tr;
 }
@@ -125,87 +722,132 @@ Transformation Registration::register_point2surface(
 {
     // we minimise the following distance measure:
     // min e = sum(i=1.._n)(|| nTarget[i] . ( R src[i] + T - target[i] ) ) ||^2)
+    // or, with a robust kernel, the sum of its weighted residuals; every
+    // solve is a Gauss-Newton step from the points moved by the last one
 
-    int numRows = _src.size();
-    double * A = new double[numRows * 6];
-    double * b = new double[numRows];
-    memset(A,0,sizeof(double)*numRows*6);
-    memset(b,0,sizeof(double)*numRows);
+    return gauss_newton( iterations_, [&]( const Transformation & _current ) {
+        return point2surface_step( _src, _target, _target_normals, _current );
+    } );
+}
 
-    for(int i = 0; i < (int) _src.size(); i++)
-    {
-        // EXERCISE 2.5 /////////////////////////////////////////////////////////////
-        // point-2-surface constraints
-        // set up matrix A and b with the linear constraints
-
-        ////////////////////////////////////////////////////////////////////////////
-        
-        // A should only be about source points
-        A[i * 6 + 0] = _target_normals[i].v[2] * _src[i].v[1] - _target_normals[i].v[1] * _src[i].v[2];
-        A[i * 6 + 1] = _target_normals[i].v[0] * _src[i].v[2] - _target_normals[i].v[2] * _src[i].v[0];
-        A[i * 6 + 2] = _target_normals[i].v[1] * _src[i].v[0] - _target_normals[i].v[0] * _src[i].v[1];
-        A[i * 6 + 3] = _target_normals[i].v[0];
-        A[i * 6 + 4] = _target_normals[i].v[1];
-        A[i * 6 + 5] = _target_normals[i].v[2];
-
-        // b should be the distance between each target point and src point
-        b[i] = _target_normals[i].v[0] * _target[i].v[0] + _target_normals[i].v[1] * _target[i].v[1] + _target_normals[i].v[2] * _target[i].v[2]
-            - _target_normals[i].v[0] * _src[i].v[0] - _target_normals[i].v[1] * _src[i].v[1] - _target_normals[i].v[2] * _src[i].v[2];
-
-        ////////////////////////////////////////////////////////////////////////////
-    }
 
-    // solve overdetermined Ax=b
-    double x[6];
+//=============================================================================
 
-    Transformation tr;
+// one point-2-surface step from the points moved by _current
+Transformation Registration::point2surface_step(
+    const std::vector< Vector3d > & _src,   // moving points (source)
+    const std::vector< Vector3d > & _target,    // points on the tangent plane (target)
+    const std::vector< Vector3d > & _target_normals, // the normal of the tangent plane
+    const Transformation & _current )   // current estimate
+{
+    // every correspondence adds the row
+    //   [ (s x n)^T  n^T ] x = n . (target - s)
+    // with s the moved source, times the square root of its weight
+    const Vector3d * src = _src.data();
+    const Vector3d * target = _target.data();
+    const Vector3d * normals = _target_normals.data();
+    const Reweighting rw( _current, kernel_, scale_ );
+    double AtA[6][6];
+    double Atb[6];
 
-    if( Solve(A,b,x,numRows) )
-    {
-        // get the transformation from the rotation angles and translation vector
-        tr.rotation_ = GetRotation( x[0], x[1], x[2] );
-        tr.translation_[0] = x[3];
-        tr.translation_[1] = x[4];
-        tr.translation_[2] = x[5];
-    }
-    else
-    {
-        printf("Registration::ComputeTransformation() => Cholesky failed\n");
-    }
+    reduce_normal_equations( (int) _src.size(),
+        [=, &rw]( int _begin, int _end, double * _sums ) {
+            point2surface_block( src, NULL, target, normals, rw, _begin, _end, _sums );
+        }, AtA, Atb );
 
-    if(A) delete [] A;
-    if(b) delete [] b;
+    return SolveNormalEquations(AtA, Atb);
+}
 
-    return tr;
+
+//=============================================================================
+
+// symmetric point-2-plane registration
+Transformation Registration::register_symmetric(
+    const std::vector< Vector3d > & _src,           // moving points (source)
+    const std::vector< Vector3d > & _src_normals,   // their normals
+    const std::vector< Vector3d > & _target,        // target points
+    const std::vector< Vector3d > & _target_normals )   // their normals
+{
+    // we minimise the following distance measure:
+    // min e = sum(i=1.._n)(|| n[i] . ( R src[i] + T - target[i] ) ) ||^2),
+    //   n[i] = (R nSrc[i] + nTarget[i]) / |R nSrc[i] + nTarget[i]|
+    // which is zero when both points lie on a common sphere, not only on
+    // a common plane, so that it fits curved surfaces in fewer steps
+
+    const Vector3d * src = _src.data();
+    const Vector3d * srcNormals = _src_normals.data();
+    const Vector3d * target = _target.data();
+    const Vector3d * normals = _target_normals.data();
+    return gauss_newton( iterations_, [&]( const Transformation & _current ) {
+        const Reweighting rw( _current, kernel_, scale_ );
+        double AtA[6][6];
+        double Atb[6];
+
+        reduce_normal_equations( (int) _src.size(),
+            [=, &rw]( int _begin, int _end, double * _sums ) {
+                point2surface_block( src, srcNormals, target, normals, rw, _begin, _end, _sums );
+            }, AtA, Atb );
+
+        return SolveNormalEquations(AtA, Atb);
+    } );
 }
 
 
 //=============================================================================
-// solve the linear system Ax = b with 6 unknowns
-bool Registration::Solve( double * A, double * b, double x[6], int numRows )
+
+// plane-2-plane (generalized ICP) registration
+Transformation Registration::register_plane2plane(
+    const std::vector< Vector3d > & _src,           // moving points (source)
+    const std::vector< Vector3d > & _src_normals,   // their normals
+    const std::vector< Vector3d > & _target,        // target points
+    const std::vector< Vector3d > & _target_normals )   // their normals
 {
-    double AtA[6][6];
-    double Atb[6];
-    for(int i = 0; i < 6; i++) {
-        Atb[i] = 0;
-        for(int j = 0; j < 6; j++) {
-            AtA[i][j] = 0;
-        }
-    }
+    // we minimise the following distance measure (Segal et al.,
+    // "Generalized-ICP", 2009):
+    // min e = sum(i=1.._n)( d[i]^T ( C(nTarget[i]) + R C(nSrc[i]) R^T )^-1 d[i] ),
+    //   d[i] = target[i] - R src[i] - T
+    // with the plane covariances C of plane2plane_block; the covariances
+    // are taken at the current estimate for every Gauss-Newton step
+
+    const Vector3d * src = _src.data();
+    const Vector3d * srcNormals = _src_normals.data();
+    const Vector3d * target = _target.data();
+    const Vector3d * normals = _target_normals.data();
+    return gauss_newton( iterations_, [&]( const Transformation & _current ) {
+        const Reweighting rw( _current, kernel_, scale_ );
+        double AtA[6][6];
+        double Atb[6];
+
+        reduce_normal_equations( (int) _src.size(),
+            [=, &rw]( int _begin, int _end, double * _sums ) {
+                plane2plane_block( src, srcNormals, target, normals, rw, _begin, _end, _sums );
+            }, AtA, Atb );
+
+        return SolveNormalEquations(AtA, Atb);
+    } );
+}
+
+
+//=============================================================================
+// solve the normal equations with 6 unknowns and return the transformation
+Transformation Registration::SolveNormalEquations( double AtA[6][6], double Atb[6] )
+{
+    double x[6];
+
+    Transformation tr;
 
-    for(int r = 0; r < numRows; r++)
+    if( CholeskySolve(AtA, Atb, x) )
     {
-        for(int i = 0; i < 6; i++)
-        {
-            Atb[i] += A[r*6+i] * b[r];
-            for(int j = 0; j < 6; j++)
-            {
-                AtA[i][j] += A[r*6+i] * A[r*6+j];
-            }
-        }
+        // the rotation angles are a rotation vector: the exact rotation of
+        // the step is its exponential, not a product of small rotations
+        tr = Transformation( Vector3d( x[0], x[1], x[2] ), Vector3d( x[3], x[4], x[5] ) );
+    }
+    else
+    {
+        printf("Registration::ComputeTransformation() => Cholesky failed\n");
     }
 
-    return CholeskySolve(AtA, Atb, x);
+    return tr;
 }
 
 
@@ -213,7 +855,8 @@ bool Registration::Solve( double * A, double * b, double x[6], int numRows )
 //=============================================================================
 
 
-// Solve x from AtAx=b using Cholesky decomposition.
+// Solve x from AtAx=b using Cholesky decomposition.  Only the upper
+// triangle of AtA is read; it is overwritten with the factor.
 bool Registration::CholeskySolve(double AtA[6][6], double Atb[6], double x[6])
 {
     int i, j, k;
@@ -274,35 +917,4 @@ bool Registration::CholeskySolve(double AtA[6][6], double Atb[6], double x[6])
 }
 
 
-//=============================================================================
-
-
-// returns the rotation matrix for 3 rotation angles
-Matrix3x3d Registration::GetRotation(double alpha, double beta, double gamma )
-{
-    Matrix3x3d R;
-
-    double sa = sin(alpha);
-    double ca = sqrt(1-sa*sa);
-    double sb = sin(beta);
-    double cb = sqrt(1-sb*sb);
-    double sr = sin(gamma);
-    double cr = sqrt(1-sr*sr);
-
-    R[0][0] = cb*cr;
-    R[0][1] = -cb*sr;
-    R[0][2] = sb;
-
-    R[1][0] = sa*sb*cr + ca*sr;
-    R[1][1] = -sa*sb*sr + ca*cr;
-    R[1][2] = -sa*cb;
-
-    R[2][0] = -ca*sb*cr + sa*sr;
-    R[2][1] = ca*sb*sr + sa*cr;
-    R[2][2] = ca*cb;
-
-    return R;
-}
-
-
 //=============================================================================
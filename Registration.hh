@@ -43,14 +43,46 @@
 
 
 // point-2-point and point-2-surface registration using linearized rotation matrices
+// (whose steps are applied through the exponential map),
+// optionally with robust kernels in an iteratively reweighted least squares loop
 class Registration
 {
 public:
 
+    // robust kernels, which weight the residual r of a correspondence by
+    // w(r) in an iteratively reweighted least squares loop; with scale k
+    //   LEAST_SQUARES  w = 1
+    //   HUBER          w = 1 for |r| <= k, k / |r| beyond
+    //   TUKEY          w = (1 - (r/k)^2)^2 for |r| < k, 0 beyond
+    //   CAUCHY         w = 1 / (1 + (r/k)^2)
+    //   GEMAN_MCCLURE  w = 1 / (1 + (r/k)^2)^2
+    enum RobustKernel { LEAST_SQUARES, HUBER, TUKEY, CAUCHY, GEMAN_MCCLURE };
+
+    // constructor: least squares, one solve per call
+    Registration();
+
+    // set the robust kernel and its scale (in the units of the points)
+    void set_robust_kernel( RobustKernel _kernel, double _scale );
+
+    // set the most solves per call; the correspondences are kept and only
+    // reweighted between them, and they stop once the step vanishes
+    void set_iterations( int _iterations );
+
+    // name of a robust kernel
+    static const char * kernelName( RobustKernel _kernel );
+
+    // how register_point2point solves for the transformation: LINEARIZED
+    // solves the normal equations for small rotation angles, CLOSED_FORM
+    // finds the exact optimal rotation from the cross-covariance of the
+    // centered points (Horn's unit quaternion method), however far the
+    // points are rotated
+    enum Point2PointSolver { LINEARIZED, CLOSED_FORM };
+
     // point-2-point registration
     Transformation register_point2point(
         const std::vector< Vector3d > & _src,
-        const std::vector< Vector3d > & _target );
+        const std::vector< Vector3d > & _target,
+        Point2PointSolver _solver = LINEARIZED );
 
     // point-2-surface registration
     Transformation register_point2surface(
@@ -58,17 +90,53 @@ public:
         const std::vector< Vector3d > & _target,
         const std::vector< Vector3d > & _target_normals );
 
+    // symmetric point-2-plane registration, along the normalized sum of the
+    // source and the target normal
+    Transformation register_symmetric(
+        const std::vector< Vector3d > & _src,
+        const std::vector< Vector3d > & _src_normals,
+        const std::vector< Vector3d > & _target,
+        const std::vector< Vector3d > & _target_normals );
+
+    // plane-2-plane (generalized ICP) registration, with the covariance of
+    // every point taken from its normal
+    Transformation register_plane2plane(
+        const std::vector< Vector3d > & _src,
+        const std::vector< Vector3d > & _src_normals,
+        const std::vector< Vector3d > & _target,
+        const std::vector< Vector3d > & _target_normals );
+
 private:
 
-    // solve the linear system Ax = b with 6 unknowns
-    bool Solve( double * A, double * b, double x[6], int numRows );
+    // one linearized point-2-point step from the points moved by _current
+    Transformation point2point_step(
+        const std::vector< Vector3d > & _src,
+        const std::vector< Vector3d > & _target,
+        const Transformation & _current );
+
+    // one point-2-surface step from the points moved by _current
+    Transformation point2surface_step(
+        const std::vector< Vector3d > & _src,
+        const std::vector< Vector3d > & _target,
+        const std::vector< Vector3d > & _target_normals,
+        const Transformation & _current );
+
+    // solve the normal equations with 6 unknowns for the transformation
+    Transformation SolveNormalEquations( double AtA[6][6], double Atb[6] );
 
     // solves the linear equation AtA x = Atb using cholesky decomposition
     bool CholeskySolve(double AtA[6][6], double Atb[6], double x[6]);
 
-    // returns the rotation matrix for 3 rotation angles
-    Matrix3x3d GetRotation(double alpha, double beta, double gamma);
+    // closed form point-2-point registration, with the weights of the
+    // residuals under _current
+    Transformation register_point2point_closed_form(
+        const std::vector< Vector3d > & _src,
+        const std::vector< Vector3d > & _target,
+        const Transformation & _current );
 
+    RobustKernel    kernel_;        // robust kernel
+    double          scale_;         // its scale
+    int             iterations_;    // most solves per call
 };
 
 #endif
@@ -43,6 +43,7 @@
 #include "Registration.hh"
 #include "ClosestPoint.hh"
 #include "gl.hh"
+#include <OpenMesh/Tools/Utils/Timer.hh>
 #include <vector>
 #include <string>
 #include <fstream>
@@ -50,6 +51,7 @@
 #include <cstdlib>
 #include <unordered_set>
 #include <algorithm>
+#include <limits>
 
 #define PI 3.14159265
 
@@ -111,6 +113,13 @@ RegistrationViewer(const char* _title, int _width, int _height)
 
     currIndex_ = 0;
     numProcessed_ = 0;
+    closestPointBackend_ = ClosestPoint::ANN_KDTREE;
+    correspondenceSearch_ = PER_SCAN;
+    point2pointSolver_ = Registration::CLOSED_FORM;
+    surfaceObjective_ = SYMMETRIC;
+    robustKernel_ = Registration::HUBER;
+    robustIterations_ = 5;
+    lastStep_ = std::numeric_limits< float >::max();
 
     mode_ = VIEW;
 }
@@ -122,6 +131,8 @@ RegistrationViewer(const char* _title, int _width, int _height)
 RegistrationViewer::
 ~RegistrationViewer()
 {
+    for(int i = 0; i < (int) closestPoints_.size(); i++)
+        invalidate_closest_point( i );
 }
 
 //-----------------------------------------------------------------------------
@@ -191,6 +202,8 @@ bool RegistrationViewer::open_meshes(const std::vector<std::string> & _filenames
 
         meshes_.push_back( mesh );
         transformations_.push_back( Transformation() );
+        closestPoints_.push_back( NULL );
+        prevMatches_.push_back( std::vector<int>() );
     }
 
 
@@ -328,13 +341,17 @@ void RegistrationViewer::draw(int index, const OpenMesh::Vec3f & color)
 
 //-----------------------------------------------------------------------------
 
+// names of the surface objectives, in the order of SurfaceObjective
+static const char * surfaceObjectiveNames[] =
+    { "point-2-surface", "symmetric point-2-plane", "plane-2-plane (generalized ICP)" };
+
 void RegistrationViewer::keyboard(int key, int x, int y)
 {
     switch (key)
     {
         case ' ':
         {
-            std::cout << "Register point-2-surface..." << std::endl;
+            std::cout << "Register " << surfaceObjectiveNames[surfaceObjective_] << "..." << std::endl;
             perform_registration(true);
             glutPostRedisplay();
             break;
@@ -349,9 +366,15 @@ void RegistrationViewer::keyboard(int key, int x, int y)
         case 'n':
         {
             sampledPoints_.clear();
+            for(int i = 0; i < (int) prevMatches_.size(); i++)
+                prevMatches_[i].clear();
+            mergedPrevMatches_.clear();
+            lastStep_ = std::numeric_limits< float >::max();
             numProcessed_ = std::min( numProcessed_+1, int(meshes_.size()) );
             currIndex_ = (currIndex_+1) % int(meshes_.size());
             std::cout << "Process scan " << currIndex_ << " of " << int(meshes_.size()) << std::endl;
+            if( correspondenceSearch_ != PER_SCAN )
+                update_merged_index();
             glutPostRedisplay();
             break;
         }
@@ -360,6 +383,46 @@ void RegistrationViewer::keyboard(int key, int x, int y)
             save_points();
             break;
         }
+        case 'c':
+        {
+            closestPointBackend_ = ClosestPoint::Backend( (closestPointBackend_ + 1) % (ClosestPoint::HASH_GRID + 1) );
+            for(int i = 0; i < (int) closestPoints_.size(); i++)
+                invalidate_closest_point( i );
+            std::cout << "Closest points: " << ClosestPoint::backendName( closestPointBackend_ ) << std::endl;
+            break;
+        }
+        case 'b':
+        {
+            benchmark_closest_point();
+            break;
+        }
+        case 'm':
+        {
+            correspondenceSearch_ = CorrespondenceSearch( (correspondenceSearch_ + 1) % (MERGED_CLOSEST + 1) );
+            const char * names[] = { "per scan structures", "merged index, closest per scan", "merged index, closest overall" };
+            std::cout << "Correspondences: " << names[correspondenceSearch_] << std::endl;
+            break;
+        }
+        case 'p':
+        {
+            point2pointSolver_ = point2pointSolver_ == Registration::LINEARIZED ?
+                Registration::CLOSED_FORM : Registration::LINEARIZED;
+            std::cout << "Point-2-point solver: "
+                      << ( point2pointSolver_ == Registration::LINEARIZED ? "linearized" : "closed form" ) << std::endl;
+            break;
+        }
+        case 'o':
+        {
+            surfaceObjective_ = SurfaceObjective( (surfaceObjective_ + 1) % (PLANE2PLANE + 1) );
+            std::cout << "Surface objective: " << surfaceObjectiveNames[surfaceObjective_] << std::endl;
+            break;
+        }
+        case 'k':
+        {
+            robustKernel_ = Registration::RobustKernel( (robustKernel_ + 1) % (Registration::GEMAN_MCCLURE + 1) );
+            std::cout << "Robust kernel: " << Registration::kernelName( robustKernel_ ) << std::endl;
+            break;
+        }
         case 'h':
         {
             printf("Help:\n");
@@ -367,8 +430,15 @@ void RegistrationViewer::keyboard(int key, int x, int y)
             printf("'h'\t-\thelp\n");
             printf("'n'\t-\tnext mesh\n");
             printf("'r'\t-\tregister current mesh selected mesh using point-2-point optimization\n");
-            printf("' '\t-\tregister current mesh selected mesh using point-2-surface optimization\n");
+            printf("' '\t-\tregister current mesh selected mesh using %s optimization\n",
+                   surfaceObjectiveNames[surfaceObjective_]);
             printf("'s'\t-\tsave points to output\n");
+            printf("'c'\t-\tswitch closest point search structure\n");
+            printf("'b'\t-\tbenchmark closest point search structures\n");
+            printf("'m'\t-\tswitch correspondence search (per scan / merged index)\n");
+            printf("'p'\t-\tswitch point-2-point solver (closed form / linearized)\n");
+            printf("'k'\t-\tswitch robust kernel of the registration\n");
+            printf("'o'\t-\tswitch surface objective of ' ' (point-2-surface / symmetric / plane-2-plane)\n");
             break;
         }
         default:
@@ -477,6 +547,12 @@ void RegistrationViewer::motion(int x, int y)
             }
 
 
+            // the manual steps are composed with GL matrices in float
+            transformations_[currIndex_].orthonormalize();
+
+            // the scan has been moved, registration starts over
+            lastStep_ = std::numeric_limits< float >::max();
+
             // remeber points
             last_point_2D_ = Vec2i(x, y);
             last_point_ok_ = map_to_sphere(last_point_2D_, last_point_3D_);
@@ -631,6 +707,228 @@ get_borders(const Mesh & _mesh)
 
 
 
+//=============================================================================
+
+// get closest point structure of a scan
+ClosestPoint &
+RegistrationViewer::
+closest_point(int _index)
+{
+    if( closestPoints_[_index] == NULL )
+    {
+        closestPoints_[_index] = new ClosestPoint( closestPointBackend_ );
+        closestPoints_[_index]->setCellSize( 6 * averageVertexDistance_ );
+        closestPoints_[_index]->init( get_points( meshes_[_index] ) );
+    }
+    return *closestPoints_[_index];
+}
+
+
+//=============================================================================
+
+// drop the closest point structure of a scan
+void
+RegistrationViewer::
+invalidate_closest_point(int _index)
+{
+    delete closestPoints_[_index];
+    closestPoints_[_index] = NULL;
+    prevMatches_[_index].clear();
+}
+
+
+//=============================================================================
+
+// update the index over all registered scans
+void
+RegistrationViewer::
+update_merged_index()
+{
+    // the index holds its scans at the transformation they had when they
+    // were inserted. Usually only the current scan moves, so the index only
+    // grows by the scans registered since; it is rebuilt when the current
+    // scan is one of its scans (after wrapping around), or when one of them
+    // has moved since (e.g. while the index was not used)
+    bool rebuild = false;
+    for(int k = 0; k < (int) mergedScans_.size() && !rebuild; k++)
+    {
+        const Transformation & now = transformations_[mergedScans_[k]];
+        const Transformation & then = mergedTransformations_[k];
+        rebuild = mergedScans_[k] == currIndex_;
+        for(int i = 0; i < 3 && !rebuild; i++)
+        {
+            rebuild = now.translation_[i] != then.translation_[i];
+            for(int j = 0; j < 3 && !rebuild; j++)
+                rebuild = now.rotation_[i][j] != then.rotation_[i][j];
+        }
+    }
+
+    if( rebuild )
+    {
+        mergedIndex_.clear();
+        mergedScans_.clear();
+        mergedTransformations_.clear();
+        mergedPrevMatches_.clear();
+    }
+
+    for(int i = 0; i < numProcessed_; i++)
+    {
+        if( i == currIndex_ ) continue;
+        if( std::find( mergedScans_.begin(), mergedScans_.end(), i ) != mergedScans_.end() ) continue;
+
+        mergedIndex_.insert( transformations_[i].transformPoints( get_points( meshes_[i] ) ), i );
+        mergedScans_.push_back( i );
+        mergedTransformations_.push_back( transformations_[i] );
+    }
+}
+
+
+//=============================================================================
+
+// compare closest point backends
+void
+RegistrationViewer::
+benchmark_closest_point()
+{
+    if( numProcessed_ < 2 )
+    {
+        std::cout << "benchmark: needs at least two processed scans" << std::endl;
+        return;
+    }
+
+    // the samples of the current scan, in the local frame of each target
+    std::vector< Vector3d > srcPts = get_points( meshes_[currIndex_] );
+    std::vector< int > samples = subsample( srcPts );
+    std::vector< Vector3d > samplePts( samples.size() );
+    for(int j = 0; j < (int) samples.size(); j++)
+        samplePts[j] = srcPts[samples[j]];
+
+    std::vector< int > targets;
+    std::vector< std::vector< Vector3d > > targetPts, queries;
+    for(int i = 0; i < numProcessed_; i++)
+    {
+        if( i == currIndex_ ) continue;
+        Transformation toTarget = transformations_[i].inverse() * transformations_[currIndex_];
+        targets.push_back( i );
+        targetPts.push_back( get_points( meshes_[i] ) );
+        queries.push_back( toTarget.transformPoints( samplePts ) );
+    }
+
+    // bounded queries use the distance threshold of calculate_correspondences
+    double maxDist2 = 3;
+
+    printf("benchmark: %d samples against %d scans\n", int(samples.size()), int(targets.size()));
+    printf("%-20s %10s %10s %10s %10s\n", "backend", "build ms", "query ms", "bounded ms", "mismatch");
+
+    std::vector< std::vector< double > > refDist2( targets.size() );
+    for(int b = 0; b <= ClosestPoint::HASH_GRID; b++)
+    {
+        ClosestPoint::Backend backend = ClosestPoint::Backend( b );
+        double buildTime = 0, queryTime = 0, boundedTime = 0;
+        int mismatches = 0;
+
+        for(int t = 0; t < (int) targets.size(); t++)
+        {
+            std::vector< int > indices;
+            std::vector< double > dist2;
+            OpenMesh::Utils::Timer timer;
+
+            ClosestPoint cp( backend );
+            cp.setCellSize( 6 * averageVertexDistance_ );
+            timer.start();
+            cp.init( targetPts[t] );
+            timer.stop();
+            buildTime += timer.mseconds();
+
+            timer.start();
+            cp.getClosestPoints( queries[t], indices, dist2 );
+            timer.stop();
+            queryTime += timer.mseconds();
+
+            // the first backend is the reference (all of them are exact)
+            if( b == 0 )
+                refDist2[t] = dist2;
+            for(int j = 0; j < (int) dist2.size(); j++)
+                if( std::fabs( dist2[j] - refDist2[t][j] ) > 1e-6 * refDist2[t][j] + 1e-12 )
+                    mismatches++;
+
+            timer.start();
+            cp.getClosestPointsWithin( queries[t], maxDist2, indices, dist2 );
+            timer.stop();
+            boundedTime += timer.mseconds();
+        }
+
+        printf("%-20s %10.2f %10.2f %10.2f %10d\n", ClosestPoint::backendName( backend ),
+               buildTime, queryTime, boundedTime, mismatches);
+    }
+
+    // the merged index answers for all targets at once with one query per
+    // sample (in the world frame), it has to find the closest of them
+    {
+        std::vector< Vector3d > worldPts = transformations_[currIndex_].transformPoints( samplePts );
+        std::vector< double > dist2( worldPts.size() );
+        int mismatches = 0;
+        OpenMesh::Utils::Timer timer;
+
+        IncrementalKdTree3< double > merged;
+        timer.start();
+        for(int t = 0; t < (int) targets.size(); t++)
+            merged.insert( transformations_[targets[t]].transformPoints( targetPts[t] ), targets[t] );
+        timer.stop();
+        double buildTime = timer.mseconds();
+
+        timer.start();
+        for(int j = 0; j < (int) worldPts.size(); j++)
+            merged.closest( worldPts[j], dist2[j] );
+        timer.stop();
+        double queryTime = timer.mseconds();
+
+        for(int j = 0; j < (int) worldPts.size(); j++)
+        {
+            double ref = std::numeric_limits< double >::max();
+            for(int t = 0; t < (int) targets.size(); t++)
+                ref = std::min( ref, refDist2[t][j] );
+            if( std::fabs( dist2[j] - ref ) > 1e-6 * ref + 1e-12 )
+                mismatches++;
+        }
+
+        timer.start();
+        for(int j = 0; j < (int) worldPts.size(); j++)
+            merged.closest( worldPts[j], dist2[j], maxDist2 );
+        timer.stop();
+        double boundedTime = timer.mseconds();
+
+        printf("%-20s %10.2f %10.2f %10.2f %10d\n", "merged index",
+               buildTime, queryTime, boundedTime, mismatches);
+
+        // and the closest point on every target, in one traversal
+        std::vector< int > ids;
+        std::vector< double > labelDist2;
+        mismatches = 0;
+
+        timer.start();
+        for(int j = 0; j < (int) worldPts.size(); j++)
+        {
+            merged.closestPerLabel( worldPts[j], ids, labelDist2 );
+            for(int t = 0; t < (int) targets.size(); t++)
+                if( std::fabs( labelDist2[targets[t]] - refDist2[t][j] ) > 1e-6 * refDist2[t][j] + 1e-12 )
+                    mismatches++;
+        }
+        timer.stop();
+        queryTime = timer.mseconds();
+
+        timer.start();
+        for(int j = 0; j < (int) worldPts.size(); j++)
+            merged.closestPerLabel( worldPts[j], ids, labelDist2, maxDist2 );
+        timer.stop();
+        boundedTime = timer.mseconds();
+
+        printf("%-20s %10s %10.2f %10.2f %10d\n", "merged index/scan",
+               "", queryTime, boundedTime, mismatches);
+    }
+}
+
+
 //=============================================================================
 
 /// perform registration
@@ -639,29 +937,50 @@ RegistrationViewer::
 perform_registration(bool _tangential_motion)
 {
     std::vector< Vector3d > src;
+    std::vector< Vector3d > src_normals;
     std::vector< Vector3d > target;
     std::vector< Vector3d > target_normals;
 
     // calculate correspondences
-    calculate_correspondences( src, target, target_normals );
+    calculate_correspondences( src, src_normals, target, target_normals );
 
+    // the kernels are scaled by their usual tuning constants (95%
+    // efficiency for Gaussian noise), taking the vertex spacing as the
+    // noise level of the residuals
     Registration reg;
+    const double tuning[] = { 1.0, 1.345, 4.685, 2.385, 1.0 };
+    reg.set_robust_kernel( robustKernel_, tuning[robustKernel_] * averageVertexDistance_ );
+    reg.set_iterations( robustKernel_ == Registration::LEAST_SQUARES ? 1 : robustIterations_ );
     printf("Num correspondences: %d\n", int(src.size()) );
 
 
     // calculate optimal transformation
     Transformation opt_tr;
-    if( _tangential_motion )
+    if( _tangential_motion && surfaceObjective_ == SYMMETRIC )
+    {
+        opt_tr = reg.register_symmetric( src, src_normals, target, target_normals );
+    }
+    else if( _tangential_motion && surfaceObjective_ == PLANE2PLANE )
+    {
+        opt_tr = reg.register_plane2plane( src, src_normals, target, target_normals );
+    }
+    else if( _tangential_motion )
     {
         opt_tr = reg.register_point2surface( src, target, target_normals );
     }
     else
     {
-        opt_tr = reg.register_point2point( src, target );
+        opt_tr = reg.register_point2point( src, target, point2pointSolver_ );
     }
 
+    // remember how far the samples moved
+    lastStep_ = 0;
+    for(int i = 0; i < (int) src.size(); i++)
+        lastStep_ = std::max( lastStep_, float( length( opt_tr.transformPoint( src[i] ) - src[i] ) ) );
+
     // set transformation
     transformations_[currIndex_] = opt_tr * transformations_[currIndex_];
+    transformations_[currIndex_].orthonormalize();
 }
 static bool sample_valid(const Vector3d &p,const std::vector<int>& ids,const std::vector< Vector3d > & _pts,float len2){
     for(int j = 0; j < ids.size(); ++j){
@@ -742,10 +1061,12 @@ std::vector<int> RegistrationViewer::subsample( const std::vector< Vector3d > &
 /// calculate correspondences
 void RegistrationViewer::calculate_correspondences(
     std::vector< Vector3d > & _src,
+    std::vector< Vector3d > & _src_normals,
     std::vector< Vector3d > & _target,
     std::vector< Vector3d > & _target_normals )
 {
     _src.clear();
+    _src_normals.clear();
     _target.clear();
     _target_normals.clear();
 
@@ -755,55 +1076,188 @@ void RegistrationViewer::calculate_correspondences(
     std::vector< Vector3d > targetCandidateNormals;
     std::vector< double > src_target_dis2;
 
-    // get points on src mesh
-    std::vector< Vector3d > srcPts = get_points( meshes_[currIndex_] );
-    std::vector< Vector3d > srcNormals = get_normals( meshes_[currIndex_] );
+    // normals of correspondences do not deviate more than 60 degrees
+    float normalCompatabilityThresh = 60;
+    // distance threshold is 3 times the median distance
+    float distMedianThresh = 3;
+
+    // coarse-to-exact schedule: as long as a step moves the scan by more
+    // than the vertex spacing, approximate closest points are good enough;
+    // near convergence they are exact
+    bool coarse = lastStep_ > averageVertexDistance_;
+    double coarseEps = 1.0;
+    int coarseMaxPtsVisited = 32;
+    printf("calculate_correspondences: %s closest points\n", coarse ? "approximate" : "exact");
 
-    // transform using current scan transformation
-    srcPts = transformations_[currIndex_].transformPoints( srcPts );
-    srcNormals = transformations_[currIndex_].transformVectors( srcNormals );
+    // get points on src mesh, in its local frame
+    const Mesh & srcMesh = meshes_[currIndex_];
+    std::vector< Vector3d > srcPts = get_points( srcMesh );
 
-    // subsample the points
+    // subsample the points (the transformation is rigid, so this can be
+    // done before transforming them)
     std::vector<int> indeces = subsample( srcPts );
 
-    // iterate over all previously processed scans and find correspondences
-    // note that we perform registration to all other scans simultaneously, not only pair-wise
-    for(int i = 0; i < numProcessed_; i++)
+    // transform only the samples using current scan transformation, they
+    // are queried against every target scan
+    std::vector< Vector3d > samplePts( indeces.size() );
+    std::vector< Vector3d > sampleNormals( indeces.size() );
+    for(int j = 0; j < (int) indeces.size(); j++)
     {
-        if( i == currIndex_ ) continue;
+        Vec3f n = srcMesh.normal( Mesh::VertexHandle( indeces[j] ) );
+        samplePts[j] = transformations_[currIndex_].transformPoint( srcPts[indeces[j]] );
+        sampleNormals[j] = transformations_[currIndex_].transformVector( Vector3d(n[0], n[1], n[2]) );
+    }
+    std::vector< Vector3d > localSamplePts;
+    std::vector< int > bestIndices;
+    std::vector< double > bestDist2;
 
-        // get points on target meshes
-        std::vector< Vector3d > targetPts = get_points( meshes_[i] );
-        std::vector< Vector3d > targetNormals = get_normals( meshes_[i] );
-        std::vector< bool > targetBorders = get_borders( meshes_[i] );
+    // what the closest point searches of this iteration visited
+    SearchStats searchStats;
+
+    // keep the match of sample j on scan _scan, unless it is a border vertex
+    // of that scan; _targetPt is already transformed
+    auto add_candidate = [&]( int j, int _scan, int _vertex, const Vector3d & _targetPt, double _dist2 )
+    {
+        const Mesh & targetMesh = meshes_[_scan];
+        Mesh::VertexHandle bestVertex( _vertex );
+
+        // do not keep border correspondences
+        if( targetMesh.is_boundary( bestVertex ) ) return;
+
+        Vec3f n = targetMesh.normal( bestVertex );
+        srcCandidatePts.push_back( samplePts[j] );
+        srcCandidateNormals.push_back( sampleNormals[j] );
+        targetCandidatePts.push_back( _targetPt );
+        targetCandidateNormals.push_back( transformations_[_scan].transformVector( Vector3d(n[0], n[1], n[2]) ) );
+        src_target_dis2.push_back( _dist2 );
+    };
+
+    switch( correspondenceSearch_ )
+    {
+        // one query per sample finds the closest point on all registered scans
+        case MERGED_CLOSEST:
+        {
+            update_merged_index();
+            mergedIndex_.setApproximation( coarse ? coarseEps : 0.0, coarse ? coarseMaxPtsVisited : 0 );
+
+            // the matches of the previous iteration are good guesses here too
+            std::vector< int > & prevMatches = mergedPrevMatches_;
+            if( prevMatches.size() != samplePts.size() )
+                prevMatches.assign( samplePts.size(), -1 );
+            bestIndices.resize( samplePts.size() );
+            bestDist2.resize( samplePts.size() );
+
+#pragma omp parallel
+            {
+                SearchStats stats;
+
+#pragma omp for schedule(dynamic,256)
+                for(int j = 0; j < (int) samplePts.size(); j++)
+                    bestIndices[j] = mergedIndex_.closest( samplePts[j], bestDist2[j], distMedianThresh,
+                                                           prevMatches[j], &stats );
+
+#pragma omp critical (searchStats)
+                searchStats += stats;
+            }
+            prevMatches = bestIndices;
 
-        // transform using current scan transformation
-        targetPts = transformations_[i].transformPoints( targetPts );
-        targetNormals = transformations_[i].transformVectors( targetNormals );
+            for(int j = 0; j < (int) indeces.size(); j++)
+            {
+                // no target point within the distance threshold
+                if( bestIndices[j] < 0 ) continue;
 
-        // set up closest point structure
-        ClosestPoint cp;
-        cp.init( targetPts );
+                // the index holds the target points already transformed
+                int id = bestIndices[j];
+                add_candidate( j, mergedIndex_.label( id ), mergedIndex_.index( id ), mergedIndex_.point( id ), bestDist2[j] );
+            }
+            break;
+        }
 
-        // find closest points for each src vertex
-        for(int j = 0; j < (int) indeces.size(); j++)
+        // one traversal per sample finds the closest point on every
+        // registered scan, the same matches as searching each scan
+        case MERGED_PER_SCAN:
         {
-            int index = indeces[j];
+            update_merged_index();
+            mergedIndex_.setApproximation( coarse ? coarseEps : 0.0, coarse ? coarseMaxPtsVisited : 0 );
 
-            int bestIndex = cp.getClosestPoint(srcPts[index]);
+            // closest point on scan i of sample j is at j*numScans + i
+            int numScans = mergedIndex_.numLabels();
+            bestIndices.resize( samplePts.size() * numScans );
+            bestDist2.resize( samplePts.size() * numScans );
 
-            // do not keep border correspondences
-            if( !targetBorders[bestIndex] )
+#pragma omp parallel
+            {
+                // kept for all queries of the thread, which then allocate nothing
+                std::vector< int > ids;
+                std::vector< double > dist2;
+                SearchStats stats;
+
+#pragma omp for schedule(dynamic,256)
+                for(int j = 0; j < (int) samplePts.size(); j++)
+                {
+                    mergedIndex_.closestPerLabel( samplePts[j], ids, dist2, distMedianThresh, &stats );
+                    std::copy( ids.begin(), ids.end(), bestIndices.begin() + j*numScans );
+                    std::copy( dist2.begin(), dist2.end(), bestDist2.begin() + j*numScans );
+                }
+
+#pragma omp critical (searchStats)
+                searchStats += stats;
+            }
+
+            for(int i = 0; i < numScans; i++)
+            {
+                for(int j = 0; j < (int) indeces.size(); j++)
+                {
+                    // no target point within the distance threshold
+                    int id = bestIndices[j*numScans + i];
+                    if( id < 0 ) continue;
+
+                    add_candidate( j, i, mergedIndex_.index( id ), mergedIndex_.point( id ), bestDist2[j*numScans + i] );
+                }
+            }
+            break;
+        }
+
+        // iterate over all previously processed scans and find correspondences
+        // note that we perform registration to all other scans simultaneously, not only pair-wise
+        case PER_SCAN:
+        {
+            for(int i = 0; i < numProcessed_; i++)
             {
-                srcCandidatePts.push_back( srcPts[index] );
-                srcCandidateNormals.push_back( srcNormals[index] );
-                targetCandidatePts.push_back( targetPts[bestIndex] );
-                targetCandidateNormals.push_back( targetNormals[bestIndex] );
-                src_target_dis2.push_back(length2(srcPts[index]-targetPts[bestIndex]));
+                if( i == currIndex_ ) continue;
+
+                const Mesh & targetMesh = meshes_[i];
+
+                // the scan's closest point structure is in its local frame, so map
+                // the samples there; this leaves the distances unchanged
+                localSamplePts = transformations_[i].inverse().transformPoints( samplePts );
+
+                // find closest points (and squared distances) for all src samples
+                // at once; pairs beyond the distance threshold would be pruned
+                // anyway, so the search only looks that far. The matches of the
+                // previous iteration are good guesses, as the scan moves little
+                std::vector< int > & prevMatches = prevMatches_[i];
+                closest_point( i ).setApproximation( coarse ? coarseEps : 0.0, coarse ? coarseMaxPtsVisited : 0 );
+                closest_point( i ).getClosestPointsWithin( localSamplePts, distMedianThresh, bestIndices, bestDist2,
+                                                           &prevMatches, &searchStats );
+                prevMatches = bestIndices;
+
+                for(int j = 0; j < (int) indeces.size(); j++)
+                {
+                    // no target point within the distance threshold
+                    if( bestIndices[j] < 0 ) continue;
+
+                    // transform only the matched target point back
+                    Vec3f p = targetMesh.point( Mesh::VertexHandle( bestIndices[j] ) );
+                    Vector3d targetPt = transformations_[i].transformPoint( Vector3d(p[0], p[1], p[2]) );
+                    add_candidate( j, i, bestIndices[j], targetPt, bestDist2[j] );
+                }
             }
+            break;
         }
     }
 
+    searchStats.print("calculate_correspondences: closest points");
     printf("calculate_correspondences: candidate num: %d\n",srcCandidatePts.size());
 
     // EXERCISE 2.3 /////////////////////////////////////////////////////////////
@@ -812,20 +1266,22 @@ void RegistrationViewer::calculate_correspondences(
     // - distance threshold
     // - normal compatability
     //
-    // fill _src, _target, and _target_normals from the candidate pairs
-
-    // normals of correspondences do not deviate more than 60 degrees
-    float normalCompatabilityThresh = 60;
-    // distance threshold is 3 times the median distance
-    float distMedianThresh = 3;
+    // fill _src, _src_normals, _target, and _target_normals from the
+    // candidate pairs
+    //
+    // (the thresholds are defined above, the distance threshold also bounds
+    // the closest point search)
 
     ////////////////////////////////////////////////////////////////////////////
 
-    // we use a tombstone method for pruning
+    // keep the compatible pairs in one pass; far pairs that slip through
+    // are down-weighted by the robust kernel of the registration
     int size = srcCandidateNormals.size();
-    double tombstone = 0.0;
+    _src.reserve( size );
+    _src_normals.reserve( size );
+    _target.reserve( size );
+    _target_normals.reserve( size );
 
-    // mark the places of not matched ones
     for (int index = 0; index < size; index++)
     {
         // calculate the long edge of the triangle
@@ -835,32 +1291,14 @@ void RegistrationViewer::calculate_correspondences(
         // compute the normal vector compatibility and distance thresh
         if (src_target_dis2[index] > distMedianThresh ||
             2 * asin(length_long_edge/2) * 180 / PI > normalCompatabilityThresh)
-                src_target_dis2[index] = tombstone;
-    }
+                continue;
 
-    // delete those ones with tombstones
-    int counter = 0;
-    for (auto iter = src_target_dis2.begin(); iter != src_target_dis2.end(); /*DO NOTHING HERE*/)
-    {
-        if (*iter == tombstone)
-        {
-            srcCandidatePts.erase(srcCandidatePts.begin() + counter);
-            srcCandidateNormals.erase(srcCandidateNormals.begin() + counter);
-            targetCandidatePts.erase(targetCandidatePts.begin() + counter);
-            targetCandidateNormals.erase(targetCandidateNormals.begin() + counter);
-            iter = src_target_dis2.erase(src_target_dis2.begin() + counter);
-        }
-        else 
-        {
-            iter++;
-            counter++;
-        }
+        _src.push_back( srcCandidatePts[index] );
+        _src_normals.push_back( srcCandidateNormals[index] );
+        _target.push_back( targetCandidatePts[index] );
+        _target_normals.push_back( targetCandidateNormals[index] );
     }
 
-    _src = srcCandidatePts;
-    _target = targetCandidatePts;
-    _target_normals = targetCandidateNormals;
-
     ////////////////////////////////////////////////////////////////////////////
 
 }
@@ -46,6 +46,9 @@
 #include "GlutExaminer.hh"
 #include <OpenMesh/Core/Mesh/TriMesh_ArrayKernelT.hh>
 #include "Transformation.hh"
+#include "Registration.hh"
+#include "ClosestPoint.hh"
+#include "IncrementalKdTree3.hh"
 
 
 //== CLASS DEFINITION =========================================================
@@ -102,6 +105,7 @@ private:
     /// calculate correspondences
     void calculate_correspondences(
         std::vector< Vector3d > & src,
+        std::vector< Vector3d > & src_normals,
         std::vector< Vector3d > & target,
         std::vector< Vector3d > & target_normals );
 
@@ -118,6 +122,22 @@ private:
     /// get average vertex distance
     float get_average_vertex_distance(const Mesh & mesh);
 
+    /// get closest point structure of a scan, in the scan's local frame
+    /// (built on first use and kept until invalidated)
+    ClosestPoint & closest_point(int _index);
+
+    /// drop the closest point structure of a scan, call when its vertices
+    /// change (not when it moves)
+    void invalidate_closest_point(int _index);
+
+    /// bring the merged index up to date: it holds all processed scans but
+    /// the current one, in their current position
+    void update_merged_index();
+
+    /// time building and querying all closest point backends on the
+    /// correspondence queries of the current scan
+    void benchmark_closest_point();
+
 protected:
 
     enum Mode { VIEW, MOVE } mode_;
@@ -132,8 +152,38 @@ protected:
     std::vector< Mesh >                       meshes_;
     std::vector< std::vector<unsigned int> >  indices_;
     std::vector< Transformation >             transformations_;
+    std::vector< ClosestPoint * >             closestPoints_;
+    ClosestPoint::Backend                     closestPointBackend_;
+    std::vector< std::vector<int> >           prevMatches_;
+
+    /// how correspondences are searched: in the closest point structure of
+    /// each registered scan, or in one index over all of them (labeled by
+    /// scan index) for the closest point on each scan or on any scan
+    enum CorrespondenceSearch { PER_SCAN, MERGED_PER_SCAN, MERGED_CLOSEST };
+    CorrespondenceSearch                      correspondenceSearch_;
+    IncrementalKdTree3< double >              mergedIndex_;
+    std::vector< int >                        mergedScans_;
+    std::vector< Transformation >             mergedTransformations_;
+    std::vector< int >                        mergedPrevMatches_;
 
     std::vector< int >                        sampledPoints_;
+
+    /// how point-2-point registration solves for the transformation
+    Registration::Point2PointSolver           point2pointSolver_;
+
+    /// objective of the registration with tangential motion: distance to
+    /// the target plane, symmetric distance to both planes, or plane-2-plane
+    /// (generalized ICP)
+    enum SurfaceObjective { POINT2SURFACE, SYMMETRIC, PLANE2PLANE };
+    SurfaceObjective                          surfaceObjective_;
+
+    /// robust kernel of the registration, and the most reweighted solves
+    /// for one set of correspondences
+    Registration::RobustKernel                robustKernel_;
+    int                                       robustIterations_;
+
+    /// largest motion of a sample in the last registration step
+    float                                     lastStep_;
 };
 
 
@@ -0,0 +1,98 @@
+//=============================================================================
+//
+//   Code framework for the lecture
+//
+//   "Surface Representation and Geometric Modeling"
+//
+//   Mark Pauly, Mario Botsch, Balint Miklos, and Hao Li
+//
+//   Copyright (C) 2007 by  Applied Geometry Group and
+//                          Computer Graphics Laboratory, ETH Zurich
+//
+//-----------------------------------------------------------------------------
+//
+//                                License
+//
+//   This program is free software; you can redistribute it and/or
+//   modify it under the terms of the GNU General Public License
+//   as published by the Free Software Foundation; either version 2
+//   of the License, or (at your option) any later version.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program; if not, write to the Free Software
+//   Foundation, Inc., 51 Franklin Street, Fifth Floor,
+//   Boston, MA  02110-1301, USA.
+//
+//=============================================================================
+//=============================================================================
+//
+//  CLASS SearchStats
+//
+//=============================================================================
+
+
+#ifndef SEARCHSTATS_HH_
+#define SEARCHSTATS_HH_
+
+#include <cstdio>
+
+/**
+ * SearchStats class
+ *
+ * counters of what closest point searches did, summed over queries. The
+ * search structures (KdTree3, HashGrid3, ClosestPoint) add to a SearchStats
+ * passed to their queries. A SearchStats is not locked: threads searching at
+ * the same time count into their own and merge them with += afterwards.
+ *
+ * For the grid, nodes are the cells looked up and leaves the non-empty ones
+ * among them.
+ */
+struct SearchStats
+{
+    long long queries;      ///< searches
+    long long nodes;        ///< inner nodes visited
+    long long leaves;       ///< leaves (buckets) searched
+    long long points;       ///< points whose distance was computed
+    long long leafHits;     ///< leaves which improved the result
+    long long earlyOuts;    ///< searches which reached the limit on points
+                            ///< visited, so that it cut them short
+    long long hintExits;    ///< searches answered in the leaf of their hint
+
+    SearchStats() { reset(); }
+
+    void reset()
+    {
+        queries = nodes = leaves = points = leafHits = earlyOuts = hintExits = 0;
+    }
+
+    SearchStats & operator+=(const SearchStats & _other)
+    {
+        queries   += _other.queries;
+        nodes     += _other.nodes;
+        leaves    += _other.leaves;
+        points    += _other.points;
+        leafHits  += _other.leafHits;
+        earlyOuts += _other.earlyOuts;
+        hintExits += _other.hintExits;
+        return *this;
+    }
+
+    /// print one line: the totals and the averages per query
+    void print(const char * _what) const
+    {
+        double q = queries > 0 ? (double) queries : 1.0;
+        printf("%s: %lld queries, per query %.1f nodes, %.2f leaves, %.1f points, "
+               "%.2f leaf hits; %lld early outs, %lld hint exits\n",
+               _what, queries, nodes / q, leaves / q, points / q, leafHits / q,
+               earlyOuts, hintExits);
+    }
+};
+
+
+//=============================================================================
+#endif /* SEARCHSTATS_HH_ */
@@ -94,6 +94,62 @@ Transformation(float angle, Vector3f axis)
 
 
 
+//=============================================================================
+Transformation::
+Transformation(const Vector3d & omega, const Vector3d & t)
+{
+    // Rodrigues' formula R = I + a [w]x + b [w]x^2, with a = sin(angle)/angle
+    // and b = (1 - cos(angle))/angle^2 (by their series for small angles)
+    double x = omega[0], y = omega[1], z = omega[2];
+    double theta2 = x*x + y*y + z*z;
+    double a, b;
+    if (theta2 < 1e-8) {
+        a = 1.0 - theta2/6.0;
+        b = 0.5 - theta2/24.0;
+    } else {
+        double theta = sqrt(theta2);
+        a = sin(theta)/theta;
+        b = (1.0 - cos(theta))/theta2;
+    }
+
+    rotation_[0][0] = 1.0 - b*(y*y + z*z);
+    rotation_[0][1] = -a*z + b*x*y;
+    rotation_[0][2] =  a*y + b*x*z;
+    rotation_[1][0] =  a*z + b*x*y;
+    rotation_[1][1] = 1.0 - b*(x*x + z*z);
+    rotation_[1][2] = -a*x + b*y*z;
+    rotation_[2][0] = -a*y + b*x*z;
+    rotation_[2][1] =  a*x + b*y*z;
+    rotation_[2][2] = 1.0 - b*(x*x + y*y);
+
+    translation_ = t;
+}
+
+
+//=============================================================================
+Transformation::
+Transformation(const double q[4], const Vector3d & t)
+{
+    set_identity();
+    translation_ = t;
+
+    double l = sqrt(q[0]*q[0] + q[1]*q[1] + q[2]*q[2] + q[3]*q[3]);
+    if (l > 0) {
+        double w = q[0]/l, x = q[1]/l, y = q[2]/l, z = q[3]/l;
+        rotation_[0][0] = 1.0 - 2.0*(y*y + z*z);
+        rotation_[0][1] = 2.0*(x*y - w*z);
+        rotation_[0][2] = 2.0*(x*z + w*y);
+        rotation_[1][0] = 2.0*(x*y + w*z);
+        rotation_[1][1] = 1.0 - 2.0*(x*x + z*z);
+        rotation_[1][2] = 2.0*(y*z - w*x);
+        rotation_[2][0] = 2.0*(x*z - w*y);
+        rotation_[2][1] = 2.0*(y*z + w*x);
+        rotation_[2][2] = 1.0 - 2.0*(x*x + y*y);
+    }
+}
+
+
+
 //=============================================================================
 
 void
@@ -105,6 +161,62 @@ set_identity()
 }
 
 
+//=============================================================================
+
+// quaternion of the rotation (Shepperd's method: from the largest of the
+// four squared components, so that no small number is divided by)
+void
+Transformation::
+get_quaternion(double q[4]) const
+{
+    const Matrix3x3d & R = rotation_;
+    double tr = R[0][0] + R[1][1] + R[2][2];
+
+    if (tr >= R[0][0] && tr >= R[1][1] && tr >= R[2][2]) {
+        double r = sqrt(1.0 + tr);
+        q[0] = 0.5*r;
+        q[1] = 0.5*(R[2][1] - R[1][2])/r;
+        q[2] = 0.5*(R[0][2] - R[2][0])/r;
+        q[3] = 0.5*(R[1][0] - R[0][1])/r;
+    } else if (R[0][0] >= R[1][1] && R[0][0] >= R[2][2]) {
+        double r = sqrt(1.0 + R[0][0] - R[1][1] - R[2][2]);
+        q[0] = 0.5*(R[2][1] - R[1][2])/r;
+        q[1] = 0.5*r;
+        q[2] = 0.5*(R[0][1] + R[1][0])/r;
+        q[3] = 0.5*(R[0][2] + R[2][0])/r;
+    } else if (R[1][1] >= R[2][2]) {
+        double r = sqrt(1.0 - R[0][0] + R[1][1] - R[2][2]);
+        q[0] = 0.5*(R[0][2] - R[2][0])/r;
+        q[1] = 0.5*(R[0][1] + R[1][0])/r;
+        q[2] = 0.5*r;
+        q[3] = 0.5*(R[1][2] + R[2][1])/r;
+    } else {
+        double r = sqrt(1.0 - R[0][0] - R[1][1] + R[2][2]);
+        q[0] = 0.5*(R[1][0] - R[0][1])/r;
+        q[1] = 0.5*(R[0][2] + R[2][0])/r;
+        q[2] = 0.5*(R[1][2] + R[2][1])/r;
+        q[3] = 0.5*r;
+    }
+
+    double l = sqrt(q[0]*q[0] + q[1]*q[1] + q[2]*q[2] + q[3]*q[3]);
+    double s = q[0] < 0 ? -1.0/l : 1.0/l;
+    for (int i = 0; i < 4; i++)
+        q[i] *= s;
+}
+
+
+//=============================================================================
+
+void
+Transformation::
+orthonormalize()
+{
+    double q[4];
+    get_quaternion(q);
+    rotation_ = Transformation(q, translation_).rotation_;
+}
+
+
 //=============================================================================
 
 Transformation
@@ -60,9 +60,24 @@ public:
     /// constructor: rotation around axis
     Transformation(float angle, Vector3f axis);
 
+    /// constructor: rotation by the rotation vector omega (its length is
+    /// the angle; exponential map) and translation
+    Transformation(const Vector3d & omega, const Vector3d & t);
+
+    /// constructor: rotation by the quaternion q = (w, x, y, z), which is
+    /// normalized, and translation
+    Transformation(const double q[4], const Vector3d & t);
+
     /// set identity transformation
     void set_identity();
 
+    /// get the unit quaternion q = (w, x, y, z) of the rotation (w >= 0)
+    void get_quaternion(double q[4]) const;
+
+    /// make the rotation orthonormal again, through its quaternion, after
+    /// rounding errors have piled up in compositions
+    void orthonormalize();
+
     /// apply transformation to current OpenGL Matrix
     void apply_gl();
 